@@ -0,0 +1,66 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "attenuation.h"
+
+#include <algorithm>
+#include <math.h>
+
+
+MLaAttenuationTable::MLaAttenuationTable()
+    : m_valid(false)
+{
+    MLaCoefficients none = { 0, 0, 0, 0, 0, 0, 0 };
+    m_coefficients = none;
+}
+
+double MLaAttenuationTable::exact(double s) const
+{
+    const double r = sqrt(s);
+    return (m_coefficients.c1 * log10(r * m_coefficients.c3 + m_coefficients.c4)) +
+           (m_coefficients.c5 * (r + m_coefficients.c6));
+}
+
+double MLaAttenuationTable::build(const MLaCoefficients &coefficients)
+{
+    m_coefficients = coefficients;
+
+    const int octaves = MaxExponent - MinExponent;
+    m_nodes.resize(octaves * Steps + 1);
+    for (int octave = 0; octave < octaves; octave++)
+    {
+        for (int step = 0; step < Steps; step++)
+        {
+            m_nodes[octave * Steps + step] =
+                exact(ldexp(1.0 + (double)step / Steps, MinExponent + octave));
+        }
+    }
+    m_nodes[octaves * Steps] = exact(ldexp(1.0, MaxExponent));
+
+    // The correction is smooth, so the error between two nodes peaks near
+    // the middle. Check around it through evaluate() itself, which also
+    // covers the index computation.
+    m_valid = true;
+    double maxError = 0;
+    for (size_t i = 0; i + 1 < m_nodes.size(); i++)
+    {
+        const double s0 = ldexp(1.0 + (double)(i % Steps) / Steps,
+                                MinExponent + (int)(i / Steps));
+        const double s1 = ldexp(1.0 + (double)(i % Steps + 1) / Steps,
+                                MinExponent + (int)(i / Steps));
+        for (int k = 1; k < 4; k++)
+        {
+            const double s = s0 + (s1 - s0) * k / 4;
+            const double error = fabs(evaluate(s) - exact(s));
+            if (!(error < HUGE_VAL))
+            {
+                // The correction is not defined over the whole range.
+                m_valid = false;
+                return HUGE_VAL;
+            }
+            maxError = std::max(maxError, error);
+        }
+    }
+
+    m_valid = maxError < MLaAttenuationMaxError;
+    return maxError;
+}
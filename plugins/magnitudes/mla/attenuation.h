@@ -0,0 +1,107 @@
+/*
+ * File:   attenuation.h
+ */
+
+#ifndef __MLA_ATTENUATION_H__
+#define __MLA_ATTENUATION_H__
+
+#include "coefficients.h"
+
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+Largest error (in magnitude units) a table may have against the exact
+distance correction to be used.
+*/
+const double MLaAttenuationMaxError = 1E-4;
+
+/*
+Tabulates the distance correction of a zone
+
+    c1*log10(R*c3 + c4) + c5*(R + c6)
+
+as a function of S = R^2, which spares the square root of the distance as
+well as the logarithm. The nodes are spaced evenly on a logarithmic scale,
+Steps nodes per octave of S, and the correction is interpolated linearly in
+between. A node index and the interpolation weight are read directly from
+the exponent and mantissa bits of S.
+
+The table covers hypocentral distances from 1 to 2048 km, which includes
+everything up to the 11 degrees of MLa at any depth. Outside of it the
+correction is evaluated exactly.
+*/
+class MLaAttenuationTable
+{
+    public:
+
+        // Nodes per octave of S, the bits of the mantissa used as index.
+        static const int StepBits = 6;
+        static const int Steps = 1 << StepBits;
+
+        // Covered range of S, [2^MinExponent, 2^MaxExponent) km^2.
+        static const int MinExponent = 0;
+        static const int MaxExponent = 22;
+
+        MLaAttenuationTable();
+
+        /*
+        Tabulates the correction of a zone and verifies the table between
+        all pairs of nodes.
+
+        @param coefficients: The coefficients of the zone.
+        @returns The largest error of the table. The table is only used if
+                 it is below MLaAttenuationMaxError.
+        */
+        double build(const MLaCoefficients &coefficients);
+
+        // Returns whether the table is used.
+        bool valid() const { return m_valid; }
+
+        /*
+        Returns the distance correction.
+
+        @param s: The squared hypocentral distance (in km^2).
+        */
+        double evaluate(double s) const
+        {
+            uint64_t bits;
+            memcpy(&bits, &s, sizeof(bits));
+
+            // Unsigned, so that exponents below the range wrap around and
+            // fail the range check as well.
+            const uint64_t octave = (bits >> 52) - (1023 + MinExponent);
+            if (!m_valid || octave >= (uint64_t)(MaxExponent - MinExponent))
+            {
+                return exact(s);
+            }
+
+            const int fractionBits = 52 - StepBits;
+            const uint64_t index =
+                (octave << StepBits) | ((bits >> fractionBits) & (Steps - 1));
+            const double weight =
+                (double)(bits & (((uint64_t)1 << fractionBits) - 1)) *
+                (1.0 / ((uint64_t)1 << fractionBits));
+
+            const double *node = &m_nodes[index];
+            return node[0] + weight * (node[1] - node[0]);
+        }
+
+        /*
+        Returns the distance correction, evaluated exactly like
+        Magnitude_MLA::formula().
+
+        @param s: The squared hypocentral distance (in km^2).
+        */
+        double exact(double s) const;
+
+    private:
+
+        MLaCoefficients     m_coefficients;
+        bool                m_valid;
+        std::vector<double> m_nodes;
+};
+
+#endif /* __MLA_ATTENUATION_H__ */
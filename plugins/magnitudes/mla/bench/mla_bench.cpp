@@ -0,0 +1,1228 @@
+/*
+ * File:   mla_bench.cpp
+ *
+ * Offline benchmark of the MLa hot paths: region loading and lookup from the
+ * bna file, compiled and with a region raster, station magnitude
+ * computation, the MLa amplitude search, the decimation of high rate streams
+ * and the network magnitude aggregation, and a stress test of one magnitude
+ * processor shared by several threads.
+ * Everything runs on synthetic data (the bna file next to this source and
+ * generated origins and waveforms), no database, messaging or waveform
+ * archive is needed.
+ *
+ * Every result is written as one JSON object per line, so that runs of
+ * different plugin versions can be compared with standard tools. Results are
+ * also checked against reference computations, the exit status is 1 if any
+ * check failed.
+ */
+
+#define SEISCOMP_COMPONENT MLa
+
+#include "../mla.h"
+#include "../compiledregions.h"
+#include "../decimator.h"
+#include "../tools/networkmagnitude.h"
+#include "../regionraster.h"
+#include "../vectormath.h"
+
+#include <seiscomp/config/config.h>
+#include <seiscomp/utils/keyvalues.h>
+#include <seiscomp/datamodel/origin.h>
+#if SC_API_VERSION < SC_API_VERSION_CHECK(12,0,0)
+#include <seiscomp/geo/geofeature.h>
+#else
+#include <seiscomp/geo/feature.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Minimum run time of one measurement in seconds, see --time.
+double minimumRunTime = 0.5;
+
+struct Options
+{
+    Options()
+        : origins(2000), stations(300), outsideFraction(0.2), seed(42),
+          threads(std::max(4u, std::thread::hardware_concurrency())),
+          runTime(0.5) {}
+
+    std::string regionFile;
+    std::string outputFile;
+    std::string label;
+    int         origins;
+    int         stations;
+    double      outsideFraction;
+    unsigned    seed;
+    unsigned    threads;
+    double      runTime;
+};
+
+/*
+Writes one benchmark result as a single line JSON object. Results which fail
+a check are repeated on stderr and fail the run.
+*/
+class Report
+{
+    public:
+        Report(std::ostream &os, const std::string &label)
+            : m_os(os), m_label(label), m_lineFailed(false), m_failures(0) {}
+
+        Report &begin(const std::string &benchmark)
+        {
+            m_line.str("");
+            m_lineFailed = false;
+            m_line << "{\"benchmark\":\"" << benchmark << "\"";
+            if (!m_label.empty())
+            {
+                m_line << ",\"label\":\"" << m_label << "\"";
+            }
+            return *this;
+        }
+
+        Report &field(const std::string &name, const std::string &value)
+        {
+            m_line << ",\"" << name << "\":\"" << value << "\"";
+            return *this;
+        }
+
+        Report &field(const std::string &name, double value)
+        {
+            m_line.precision(12);
+            m_line << ",\"" << name << "\":" << value;
+            return *this;
+        }
+
+        // Adds the number of results which differ from their reference,
+        // any of them fails the check.
+        Report &mismatches(const std::string &name, size_t count)
+        {
+            m_lineFailed = m_lineFailed || count > 0;
+            return field(name, (double)count);
+        }
+
+        // Adds the outcome of a check.
+        Report &check(const std::string &name, bool passed)
+        {
+            m_lineFailed = m_lineFailed || !passed;
+            return field(name, passed ? "true" : "false");
+        }
+
+        void end()
+        {
+            m_line << "}";
+            m_os << m_line.str() << std::endl;
+            if (m_lineFailed)
+            {
+                std::cerr << "Check failed: " << m_line.str() << std::endl;
+                m_failures++;
+            }
+        }
+
+        // Records a benchmark which could not be run.
+        void fail(const std::string &benchmark, const std::string &reason)
+        {
+            std::cerr << "Can not run " << benchmark << ": " << reason << std::endl;
+            m_failures++;
+        }
+
+        // Returns the number of failed checks and benchmarks.
+        size_t failures() const { return m_failures; }
+
+    private:
+        std::ostream       &m_os;
+        std::string         m_label;
+        std::ostringstream  m_line;
+        bool                m_lineFailed;
+        size_t              m_failures;
+};
+
+double elapsed(const Clock::time_point &start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/*
+Synthetic station amplitudes of one origin.
+*/
+struct SyntheticOrigin
+{
+    Seiscomp::DataModel::OriginPtr  origin;
+    double                          lat;
+    double                          lon;
+    std::vector<double>             amplitudes;
+    std::vector<double>             deltas;
+    std::vector<double>             depths;
+};
+
+std::vector<SyntheticOrigin> makeOrigins(const Options &options)
+{
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    std::vector<SyntheticOrigin> origins(options.origins);
+    for (size_t i = 0; i < origins.size(); i++)
+    {
+        SyntheticOrigin &o = origins[i];
+        if (unit(rng) < options.outsideFraction)
+        {
+            // Anywhere on the globe, mostly outside of the zones.
+            o.lat = -90.0 + 180.0 * unit(rng);
+            o.lon = -180.0 + 360.0 * unit(rng);
+        }
+        else
+        {
+            // Within the extent of the Australian zones.
+            o.lat = -44.0 + 34.0 * unit(rng);
+            o.lon = 112.0 + 43.0 * unit(rng);
+        }
+
+        double depth = 40.0 * unit(rng);
+        o.origin = Seiscomp::DataModel::Origin::Create();
+        o.origin->setLatitude(Seiscomp::DataModel::RealQuantity(o.lat));
+        o.origin->setLongitude(Seiscomp::DataModel::RealQuantity(o.lon));
+        o.origin->setDepth(Seiscomp::DataModel::RealQuantity(depth));
+
+        for (int s = 0; s < options.stations; s++)
+        {
+            o.amplitudes.push_back(pow(10.0, -3.0 + 5.0 * unit(rng)));
+            o.deltas.push_back(0.1 + 10.9 * unit(rng));
+            o.depths.push_back(depth);
+        }
+    }
+
+    return origins;
+}
+
+Seiscomp::Processing::MagnitudeProcessor::Status computeOne(
+      Magnitude_MLA &processor, const SyntheticOrigin &o, size_t s, double &value)
+{
+    return processor.computeMagnitude(
+        o.amplitudes[s],
+#if SC_API_VERSION >= SC_API_VERSION_CHECK(12,0,0)
+        "mm",
+#endif
+        -1,
+#if SC_API_VERSION >= SC_API_VERSION_CHECK(12,0,0)
+        10,
+#endif
+        o.deltas[s], o.depths[s], o.origin.get(), NULL,
+#if SC_API_VERSION >= SC_API_VERSION_CHECK(12,0,0)
+        NULL,
+#endif
+        value);
+}
+
+/*
+Returns the locations region lookups are checked on: the origins, a grid over
+the default raster box and locations around the middle of every polygon edge
+of a region set.
+*/
+std::vector<Seiscomp::Geo::Vertex> checkLocations(
+    const MLaRegionSet &regions, const std::vector<SyntheticOrigin> &origins)
+{
+    std::vector<Seiscomp::Geo::Vertex> locations(origins.size());
+    for (size_t i = 0; i < origins.size(); i++)
+    {
+        locations[i].lat = origins[i].lat;
+        locations[i].lon = origins[i].lon;
+    }
+
+    const MLaRasterSpec box;
+    Seiscomp::Geo::Vertex location;
+    for (double lat = box.latMin - 1; lat <= box.latMax + 1; lat += 0.0371)
+    {
+        for (double lon = box.lonMin - 1; lon <= box.lonMax + 1; lon += 0.0371)
+        {
+            location.lat = lat;
+            location.lon = lon;
+            locations.push_back(location);
+        }
+    }
+
+    static const double offsets[] = { 0, 1E-3, -1E-3, 1E-5, -1E-5 };
+    const size_t count = sizeof(offsets) / sizeof(offsets[0]);
+    MLaRegionSet::Polygons polygons;
+    for (size_t r = 0; r < regions.size(); r++)
+    {
+        regions.polygons(r, polygons);
+        for (size_t p = 0; p < polygons.size(); p++)
+        {
+            const std::vector<Seiscomp::Geo::Vertex> &vertices = polygons[p];
+            for (size_t v = 0; v < vertices.size(); v++)
+            {
+                // Half way along the edge to the next vertex.
+                const Seiscomp::Geo::Vertex &next = vertices[(v + 1) % vertices.size()];
+                const double lat = 0.5 * (vertices[v].lat + next.lat);
+                const double lon = 0.5 * (vertices[v].lon + next.lon);
+                for (size_t a = 0; a < count; a++)
+                {
+                    for (size_t b = 0; b < count; b++)
+                    {
+                        location.lat = lat + offsets[a];
+                        location.lon = lon + offsets[b];
+                        locations.push_back(location);
+                    }
+                }
+            }
+        }
+    }
+
+    return locations;
+}
+
+/*
+Times reading the bna file and mapping it compiled, and checks the lookups of
+the compiled region set against those of the features read from the bna file.
+*/
+void benchLoad(Report &report, const std::string &regionFile,
+               const std::vector<SyntheticOrigin> &origins)
+{
+    size_t loads = 0, regions = 0;
+    Clock::time_point start = Clock::now();
+    do
+    {
+        Seiscomp::Geo::Category category(1);
+        Seiscomp::Geo::GeoFeatureSet features;
+        features.readBNAFile(regionFile, &category);
+        MLaRegionIndex index;
+        index.build(features);
+        regions = index.size();
+        loads++;
+    }
+    while (elapsed(start) < minimumRunTime);
+    double parsed = elapsed(start) / loads;
+
+    // The compiled file goes to a temporary file instead of next to the
+    // region file.
+    Seiscomp::Geo::Category category(1);
+    Seiscomp::Geo::GeoFeatureSet features;
+    features.readBNAFile(regionFile, &category);
+    MLaRegionIndex index;
+    index.build(features);
+
+    char file[] = "/tmp/mla_bench_compiled_XXXXXX";
+    int fd = mkstemp(file);
+    if (fd < 0)
+    {
+        report.fail("region_load", "can not create a temporary compiled file");
+        return;
+    }
+    close(fd);
+
+    std::string error;
+    if (!MLaCompiledRegionSet::write(file, features, index, MLaFileVersion(), error))
+    {
+        unlink(file);
+        report.fail("region_load", "can not compile the region file: " + error);
+        return;
+    }
+
+    std::shared_ptr<MLaCompiledRegionSet> compiled;
+    loads = 0;
+    start = Clock::now();
+    do
+    {
+        compiled = MLaCompiledRegionSet::open(file, regionFile, MLaFileVersion(), error);
+        if (!compiled)
+        {
+            break;
+        }
+        loads++;
+    }
+    while (elapsed(start) < minimumRunTime);
+    double loaded = elapsed(start) / loads;
+    unlink(file);
+    if (!compiled)
+    {
+        report.fail("region_load", "can not load the compiled region file: " + error);
+        return;
+    }
+
+    size_t mismatches = 0;
+    const std::vector<Seiscomp::Geo::Vertex> locations = checkLocations(*compiled, origins);
+    for (size_t i = 0; i < locations.size(); i++)
+    {
+        mismatches += compiled->find(locations[i]) != index.find(locations[i]);
+    }
+
+    report.begin("region_load")
+        .field("regions", (double)regions)
+        .field("bna_seconds", parsed)
+        .field("compiled_seconds", loaded)
+        .field("checked", (double)locations.size())
+        .mismatches("mismatches", mismatches)
+        .end();
+}
+
+void benchLookup(Report &report, const std::string &regionFile,
+                 const MLaRegionSetPtr &regions,
+                 const std::vector<SyntheticOrigin> &origins)
+{
+    const MLaRegionSet &index = *regions;
+
+    // The features of the bna file for the linear scan, whatever the
+    // region set was loaded from.
+    Seiscomp::Geo::Category category(1);
+    Seiscomp::Geo::GeoFeatureSet featureSet;
+    featureSet.readBNAFile(regionFile, &category);
+    const std::vector<Seiscomp::Geo::GeoFeature*> &features = featureSet.features();
+
+    std::vector<Seiscomp::Geo::Vertex> locations(origins.size());
+    for (size_t i = 0; i < origins.size(); i++)
+    {
+        locations[i].lat = origins[i].lat;
+        locations[i].lon = origins[i].lon;
+    }
+
+    // The linear scan the index replaced, as reference.
+    size_t lookups = 0, mismatches = 0;
+    long sink = 0, checksum = 0;
+    Clock::time_point start = Clock::now();
+    do
+    {
+        for (size_t i = 0; i < locations.size(); i++)
+        {
+            int found = -1;
+            for (size_t f = 0; f < features.size(); f++)
+            {
+                if (features[f]->contains(locations[i]))
+                {
+                    found = f;
+                    break;
+                }
+            }
+            sink += found;
+        }
+        lookups += locations.size();
+    }
+    while (elapsed(start) < minimumRunTime);
+    double linear = lookups / elapsed(start);
+
+    lookups = 0;
+    start = Clock::now();
+    do
+    {
+        for (size_t i = 0; i < locations.size(); i++)
+        {
+            sink += index.find(locations[i]);
+        }
+        lookups += locations.size();
+    }
+    while (elapsed(start) < minimumRunTime);
+    double indexed = lookups / elapsed(start);
+
+    for (size_t i = 0; i < locations.size(); i++)
+    {
+        int found = -1;
+        for (size_t f = 0; f < features.size() && found < 0; f++)
+        {
+            if (features[f]->contains(locations[i]))
+            {
+                found = f;
+            }
+        }
+        mismatches += found != index.find(locations[i]);
+        checksum += found;
+    }
+
+    report.begin("region_lookup")
+        .field("regions", (double)features.size())
+        .field("locations", (double)locations.size())
+        .field("lookups_per_second", indexed)
+        .field("linear_lookups_per_second", linear)
+        .mismatches("mismatches", mismatches)
+        .field("checksum", (double)checksum)
+        .end();
+
+    // Keeps the compiler from dropping the timed loops.
+    if (sink == 42)
+    {
+        std::cerr << std::endl;
+    }
+}
+
+/*
+Builds region rasters of several resolutions over the default box and
+reports their memory, the time to build, cache and map them, and their lookups
+against the exact ones of the region set, on the origins and on a grid over
+the box and around every vertex.
+*/
+void benchRaster(Report &report, const MLaRegionSetPtr &regions,
+                 const std::vector<SyntheticOrigin> &origins)
+{
+    const MLaRegionSet &exact = *regions;
+
+    std::vector<Seiscomp::Geo::Vertex> locations(origins.size());
+    for (size_t i = 0; i < origins.size(); i++)
+    {
+        locations[i].lat = origins[i].lat;
+        locations[i].lon = origins[i].lon;
+    }
+    const std::vector<Seiscomp::Geo::Vertex> checked = checkLocations(exact, origins);
+
+    // The cached rasters go to a temporary file instead of next to the
+    // region file.
+    char file[] = "/tmp/mla_bench_raster_XXXXXX";
+    int fd = mkstemp(file);
+    if (fd < 0)
+    {
+        report.fail("region_raster", "can not create a temporary raster file");
+        return;
+    }
+    close(fd);
+
+    static const double resolutions[] = { 0.1, 0.05, 0.01 };
+    for (size_t k = 0; k < sizeof(resolutions) / sizeof(resolutions[0]); k++)
+    {
+        MLaRasterSpec spec;
+        spec.resolution = resolutions[k];
+
+        // Building, with the cache emptied before every build.
+        std::string error;
+        std::shared_ptr<MLaRasterRegionSet> raster;
+        size_t builds = 0;
+        Clock::time_point start = Clock::now();
+        do
+        {
+            if (truncate(file, 0) != 0)
+            {
+                break;
+            }
+            raster = MLaRasterRegionSet::create(regions, spec, file, error);
+            if (!raster)
+            {
+                break;
+            }
+            builds++;
+        }
+        while (elapsed(start) < minimumRunTime);
+        if (!raster || raster->cached())
+        {
+            report.fail("region_raster", "can not build the region raster: " + error);
+            continue;
+        }
+        double created = elapsed(start) / builds;
+        double built = raster->seconds();
+
+        size_t maps = 0;
+        start = Clock::now();
+        do
+        {
+            raster = MLaRasterRegionSet::create(regions, spec, file, error);
+            maps++;
+        }
+        while (raster && raster->cached() && elapsed(start) < minimumRunTime);
+        double mapped = raster && raster->cached() ? elapsed(start) / maps : -1;
+
+        size_t lookups = 0;
+        long sink = 0;
+        start = Clock::now();
+        do
+        {
+            for (size_t i = 0; i < locations.size(); i++)
+            {
+                sink += raster->find(locations[i]);
+            }
+            lookups += locations.size();
+        }
+        while (elapsed(start) < minimumRunTime);
+        double rastered = lookups / elapsed(start);
+
+        lookups = 0;
+        start = Clock::now();
+        do
+        {
+            for (size_t i = 0; i < locations.size(); i++)
+            {
+                sink += exact.find(locations[i]);
+            }
+            lookups += locations.size();
+        }
+        while (elapsed(start) < minimumRunTime);
+        double exactRate = lookups / elapsed(start);
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < checked.size(); i++)
+        {
+            mismatches += raster->find(checked[i]) != exact.find(checked[i]);
+        }
+
+        report.begin("region_raster")
+            .field("resolution", spec.resolution)
+            .field("rows", (double)raster->rows())
+            .field("cols", (double)raster->cols())
+            .field("memory_bytes", (double)raster->memory())
+            .field("border_fraction",
+                   (double)raster->borderCells() / ((double)raster->rows() * raster->cols()))
+            .field("build_seconds", built)
+            .field("build_and_cache_seconds", created)
+            .field("mapped_seconds", mapped)
+            .field("lookups_per_second", rastered)
+            .field("exact_lookups_per_second", exactRate)
+            .field("checked", (double)checked.size())
+            .mismatches("mismatches", mismatches)
+            .end();
+
+        // Keeps the compiler from dropping the timed loops.
+        if (sink == 42)
+        {
+            std::cerr << std::endl;
+        }
+    }
+
+    unlink(file);
+}
+
+/*
+Times computeMagnitude() of one processor over all origins.
+
+@returns The sum of the magnitudes of a single pass.
+*/
+double benchScalarMagnitude(Report &report, const char *path,
+                            Magnitude_MLA &processor,
+                            const std::vector<SyntheticOrigin> &origins)
+{
+    // One pass to get results comparable between runs and versions.
+    size_t magnitudes = 0, computed = 0;
+    double checksum = 0;
+    for (size_t i = 0; i < origins.size(); i++)
+    {
+        const SyntheticOrigin &o = origins[i];
+        for (size_t s = 0; s < o.amplitudes.size(); s++)
+        {
+            double value;
+            if (computeOne(processor, o, s, value) == Magnitude_MLA::OK)
+            {
+                checksum += value;
+                computed++;
+            }
+        }
+        magnitudes += o.amplitudes.size();
+    }
+    double inRegion = (double)computed / magnitudes;
+
+    double sink = 0;
+    magnitudes = 0;
+    Clock::time_point start = Clock::now();
+    do
+    {
+        for (size_t i = 0; i < origins.size(); i++)
+        {
+            const SyntheticOrigin &o = origins[i];
+            for (size_t s = 0; s < o.amplitudes.size(); s++)
+            {
+                double value = 0;
+                computeOne(processor, o, s, value);
+                sink += value;
+            }
+            magnitudes += o.amplitudes.size();
+        }
+    }
+    while (elapsed(start) < minimumRunTime);
+    double seconds = elapsed(start);
+
+    report.begin("magnitude")
+        .field("path", path)
+        .field("ns_per_magnitude", seconds * 1E9 / magnitudes)
+        .field("magnitudes_per_second", magnitudes / seconds)
+        .field("in_region_fraction", inRegion)
+        .field("checksum", checksum)
+        .end();
+
+    // Keeps the compiler from dropping the timed loop.
+    if (sink == 42.0)
+    {
+        std::cerr << std::endl;
+    }
+
+    return checksum;
+}
+
+/*
+Times the station magnitudes with the attenuation tables (processor), with
+the exact formula (exact) and in batches. Differences are reported against
+the exact formula, values further from it than the documented error of the
+tables (MLaAttenuationMaxError) and of the batches (MLaBatchMaxError) are
+mismatches.
+*/
+void benchMagnitude(Report &report, Magnitude_MLA &processor,
+                    Magnitude_MLA &exact,
+                    const std::vector<SyntheticOrigin> &origins)
+{
+    double checksum = benchScalarMagnitude(report, "computeMagnitude (exact)", exact, origins);
+    double tableChecksum = benchScalarMagnitude(report, "computeMagnitude", processor, origins);
+
+    // Every value against the exact formula, station corrections are not
+    // involved.
+    size_t tableMismatches = 0, batchMismatches = 0;
+    std::vector<double> values;
+    for (size_t i = 0; i < origins.size(); i++)
+    {
+        const SyntheticOrigin &o = origins[i];
+        values.assign(o.amplitudes.size(), NAN);
+        const bool batched =
+            processor.computeMagnitudes(o.origin.get(), o.amplitudes.size(),
+                                        &o.amplitudes[0], &o.deltas[0],
+                                        &o.depths[0], &values[0]) == Magnitude_MLA::OK;
+        for (size_t s = 0; s < o.amplitudes.size(); s++)
+        {
+            double reference, tabulated;
+            const bool computed = computeOne(exact, o, s, reference) == Magnitude_MLA::OK;
+            if (computed != (computeOne(processor, o, s, tabulated) == Magnitude_MLA::OK) ||
+                (computed && !(fabs(tabulated - reference) <= MLaAttenuationMaxError)))
+            {
+                tableMismatches++;
+            }
+            if (computed != batched ||
+                (computed && !(fabs(values[s] - reference) <= MLaBatchMaxError)))
+            {
+                batchMismatches++;
+            }
+        }
+    }
+
+    report.begin("magnitude")
+        .field("path", "attenuation_table")
+        .field("checksum_difference", fabs(tableChecksum - checksum))
+        .mismatches("mismatches", tableMismatches)
+        .end();
+
+    double batchChecksum = 0, sink = 0;
+    size_t magnitudes = 0;
+    Clock::time_point start = Clock::now();
+    do
+    {
+        bool firstPass = magnitudes == 0;
+        for (size_t i = 0; i < origins.size(); i++)
+        {
+            const SyntheticOrigin &o = origins[i];
+            values.resize(o.amplitudes.size());
+            if (processor.computeMagnitudes(o.origin.get(), o.amplitudes.size(),
+                                            &o.amplitudes[0], &o.deltas[0],
+                                            &o.depths[0], &values[0]) == Magnitude_MLA::OK)
+            {
+                for (size_t s = 0; s < values.size(); s++)
+                {
+                    sink += values[s];
+                    if (firstPass)
+                    {
+                        batchChecksum += values[s];
+                    }
+                }
+            }
+            magnitudes += o.amplitudes.size();
+        }
+    }
+    while (elapsed(start) < minimumRunTime);
+    double seconds = elapsed(start);
+
+    report.begin("magnitude")
+        .field("path", "computeMagnitudes")
+        .field("kernel", MLaBatchKernel())
+        .field("ns_per_magnitude", seconds * 1E9 / magnitudes)
+        .field("magnitudes_per_second", magnitudes / seconds)
+        .field("checksum", batchChecksum)
+        .field("checksum_difference", fabs(batchChecksum - checksum))
+        .mismatches("mismatches", batchMismatches)
+        .end();
+
+    // Keeps the compiler from dropping the timed loops.
+    if (sink == 42.0)
+    {
+        std::cerr << std::endl;
+    }
+}
+
+/*
+Gives access to the amplitude computation of the MLa amplitude processor.
+*/
+class BenchAmplitude : public Amplitude_MLA
+{
+    public:
+        BenchAmplitude()
+        {
+            _noiseAmplitude = 1.0;
+        }
+
+        bool compute(const Seiscomp::DoubleArray &data, size_t si1, size_t si2,
+                     double offset, double &value)
+        {
+            AmplitudeIndex dt;
+            AmplitudeValue amplitude;
+            double period, snr;
+            dt.index = dt.begin = dt.end = 0;
+            bool ok = computeAmplitude(data, 0, data.size(), si1, si2, offset,
+                                       &dt, &amplitude, &period, &snr);
+            value = amplitude.value;
+            return ok;
+        }
+};
+
+/*
+Wood-Anderson like synthetic trace: noise followed by a decaying 1.5 Hz wave
+train starting after the noise window.
+*/
+Seiscomp::DoubleArray makeWaveform(double samplingFrequency, double noiseLength,
+                                   double signalLength, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0.0, 0.01);
+
+    int n = (int)((noiseLength + signalLength) * samplingFrequency);
+    int onset = (int)(noiseLength * samplingFrequency);
+    Seiscomp::DoubleArray data(n);
+    for (int i = 0; i < n; i++)
+    {
+        double v = 0.1 + noise(rng);
+        if (i >= onset)
+        {
+            double t = (i - onset) / samplingFrequency;
+            v += 5.0 * exp(-t / 10.0) * sin(2 * M_PI * 1.5 * t);
+        }
+        data[i] = v;
+    }
+
+    return data;
+}
+
+void benchAmplitude(Report &report, const Options &options)
+{
+    static const double rates[] = { 40.0, 100.0, 200.0 };
+    static const double windows[] = { 30.0, 60.0, 150.0 };
+    const double noiseLength = 30.0;
+
+    BenchAmplitude processor;
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+    {
+        for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+        {
+            Seiscomp::DoubleArray data =
+                makeWaveform(rates[r], noiseLength, windows[w], options.seed);
+            size_t si1 = (size_t)(noiseLength * rates[r]);
+            size_t si2 = data.size();
+
+            double value = 0;
+            processor.compute(data, si1, si2, 0.1, value);
+
+            size_t amplitudes = 0;
+            size_t mismatches = 0;
+            Clock::time_point start = Clock::now();
+            do
+            {
+                double repeated = 0;
+                processor.compute(data, si1, si2, 0.1, repeated);
+                if (repeated != value)
+                {
+                    mismatches++;
+                }
+                amplitudes++;
+            }
+            while (elapsed(start) < minimumRunTime);
+            double seconds = elapsed(start);
+
+            report.begin("amplitude")
+                .field("sampling_frequency", rates[r])
+                .field("window_length", windows[w])
+                .field("kernel", MLaBatchKernel())
+                .field("samples", (double)(si2 - si1))
+                .field("amplitudes_per_second", amplitudes / seconds)
+                .field("ns_per_sample", seconds * 1E9 / amplitudes / (si2 - si1))
+                .field("amplitude", value)
+                .check("consistent", mismatches == 0)
+                .end();
+        }
+    }
+}
+
+void benchDecimation(Report &report, const Options &options)
+{
+    static const double rates[][2] = {
+        { 200.0, 100.0 }, { 250.0, 50.0 }, { 500.0, 100.0 }, { 500.0, 50.0 }
+    };
+    // Records of a typical miniSEED size.
+    const size_t recordLength = 412;
+
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+    {
+        Seiscomp::DoubleArray data = makeWaveform(rates[r][0], 30.0, 150.0, options.seed);
+        const size_t count = data.size();
+
+        MLaDecimator decimator;
+        decimator.configure(rates[r][0], rates[r][1]);
+        std::vector<double> output;
+
+        size_t samples = 0;
+        size_t outputs = 0;
+        Clock::time_point start = Clock::now();
+        do
+        {
+            decimator.reset();
+            for (size_t i = 0; i < count; i += recordLength)
+            {
+                decimator.process(data.typedData() + i,
+                                  std::min(recordLength, count - i), output);
+                outputs += output.size();
+            }
+            samples += count;
+        }
+        while (elapsed(start) < minimumRunTime);
+        double seconds = elapsed(start);
+
+        report.begin("decimation")
+            .field("sampling_frequency", rates[r][0])
+            .field("decimation_rate", rates[r][1])
+            .field("factor", decimator.factor())
+            .field("output_rate", decimator.outputRate())
+            .field("delay", decimator.delay() / rates[r][0])
+            .field("ns_per_input_sample", seconds * 1E9 / samples)
+            .field("output_fraction", (double)outputs / samples)
+            .end();
+    }
+}
+
+/*
+The network magnitude of station magnitudes as scmag averages them by
+default, computed naively from the sorted values: their mean if there are up
+to three, otherwise the 25% trimmed mean of
+Seiscomp::Math::Statistics::computeTrimmedMean(), which cuts n / 8 values off
+either end and weights the values partly within the cut by the remaining
+fraction.
+*/
+double naiveNetworkMagnitude(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+    const double cut = n > 3 ? 0.125 * n : 0;
+    const size_t whole = (size_t)cut;
+
+    double sum = 0, weights = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        double weight = 1;
+        if (i < whole || i >= n - whole)
+        {
+            weight = 0;
+        }
+        else if (i == whole || i == n - whole - 1)
+        {
+            weight = whole + 1 - cut;
+        }
+        sum += weight * values[i];
+        weights += weight;
+    }
+
+    return sum / weights;
+}
+
+/*
+Station magnitudes of an origin arriving one by one, with the network
+magnitude updated incrementally and checked against the naive computation
+from scratch after each one.
+*/
+void benchNetwork(Report &report, const Options &options)
+{
+    static const int counts[] = { 10, 100, 1000 };
+
+    std::mt19937 rng(options.seed);
+    std::normal_distribution<double> magnitudes(3.0, 0.4);
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        const int n = counts[c];
+        std::vector<std::string> ids(n);
+        std::vector<double> values(n);
+        for (int i = 0; i < n; i++)
+        {
+            std::ostringstream id;
+            id << "StationMagnitude/" << i;
+            ids[i] = id.str();
+            values[i] = magnitudes(rng);
+        }
+
+        std::vector<double> incremental(n);
+        MLaNetworkMagnitude::Result result;
+        size_t updates = 0;
+        Clock::time_point start = Clock::now();
+        do
+        {
+            MLaNetworkMagnitude network;
+            for (int i = 0; i < n; i++)
+            {
+                network.set(ids[i], values[i]);
+                network.compute(result);
+                incremental[i] = result.value;
+            }
+            updates += n;
+        }
+        while (elapsed(start) < minimumRunTime);
+        double incrementalSeconds = elapsed(start);
+
+        // The station magnitudes are rounded to the resolution, which moves
+        // the mean by half of it at most. A whole one leaves room for the
+        // rounding of the naive sums.
+        size_t mismatches = 0;
+        size_t recomputations = 0;
+        double maxDifference = 0;
+        start = Clock::now();
+        do
+        {
+            for (int i = 0; i < n; i++)
+            {
+                std::vector<double> received(values.begin(), values.begin() + i + 1);
+                const double difference = fabs(naiveNetworkMagnitude(received) - incremental[i]);
+                maxDifference = std::max(maxDifference, difference);
+                if (!(difference <= MLaNetworkMagnitude::Resolution))
+                {
+                    mismatches++;
+                }
+            }
+            recomputations += n;
+        }
+        while (elapsed(start) < minimumRunTime);
+        double fullSeconds = elapsed(start);
+
+        report.begin("network")
+            .field("stations", n)
+            .field("incremental_us_per_update", incrementalSeconds * 1E6 / updates)
+            .field("full_us_per_update", fullSeconds * 1E6 / recomputations)
+            .field("value", incremental[n - 1])
+            .field("max_difference", maxDifference)
+            .mismatches("mismatches", mismatches)
+            .end();
+    }
+}
+
+/*
+Drives one processor from 1, 2, 4, ... threads, each thread computing the
+station magnitudes of all origins starting at another origin, and checks
+every value against a single threaded run. The second pass forces the
+region file to be reloaded every few milliseconds meanwhile, so that the
+threads switch regions while others still compute with the previous ones.
+*/
+void benchConcurrent(Report &report, const Options &options,
+                     const std::vector<SyntheticOrigin> &origins)
+{
+    Seiscomp::Config::Config config;
+    Seiscomp::Util::KeyValues keys;
+    keys.setString("mla.regionfilepath", options.regionFile);
+    // Only reloads forced below happen during the run.
+    keys.setString("mla.reloadInterval", "3600");
+    Seiscomp::Processing::Settings settings(
+        "mla_bench", "XX", "BENCH", "", "HHZ", &config, &keys);
+    Magnitude_MLA processor;
+    if (!processor.setup(settings))
+    {
+        report.fail("concurrent", "can not set up the magnitude processor");
+        return;
+    }
+
+    // NaN for station magnitudes which can not be computed.
+    std::vector< std::vector<double> > expected(origins.size());
+    for (size_t o = 0; o < origins.size(); o++)
+    {
+        for (size_t s = 0; s < origins[o].amplitudes.size(); s++)
+        {
+            double value;
+            if (computeOne(processor, origins[o], s, value) !=
+                Seiscomp::Processing::MagnitudeProcessor::OK)
+            {
+                value = NAN;
+            }
+            expected[o].push_back(value);
+        }
+    }
+
+    for (int reloading = 0; reloading < 2; reloading++)
+    {
+        double singleRate = 0;
+        for (unsigned threads = 1; threads <= options.threads; threads *= 2)
+        {
+            std::atomic<bool> stop(false);
+            std::atomic<size_t> computed(0), mismatches(0);
+            std::vector<std::thread> workers;
+            Clock::time_point start = Clock::now();
+            for (unsigned t = 0; t < threads; t++)
+            {
+                workers.push_back(std::thread([&, t]()
+                {
+                    size_t count = 0, wrong = 0;
+                    for (size_t i = 0; !stop.load(std::memory_order_relaxed); i++)
+                    {
+                        size_t o = (t * origins.size() / threads + i) % origins.size();
+                        for (size_t s = 0; s < origins[o].amplitudes.size(); s++)
+                        {
+                            double value;
+                            if (computeOne(processor, origins[o], s, value) !=
+                                Seiscomp::Processing::MagnitudeProcessor::OK)
+                            {
+                                value = NAN;
+                            }
+                            const double reference = expected[o][s];
+                            if (value != reference && !(isnan(value) && isnan(reference)))
+                            {
+                                wrong++;
+                            }
+                        }
+                        count += origins[o].amplitudes.size();
+                    }
+                    computed.fetch_add(count);
+                    mismatches.fetch_add(wrong);
+                }));
+            }
+
+            size_t reloads = 0;
+            while (elapsed(start) < minimumRunTime)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                if (reloading)
+                {
+                    MLaRegionStore::requestReload();
+                    reloads++;
+                }
+            }
+            stop.store(true);
+            for (size_t t = 0; t < workers.size(); t++)
+            {
+                workers[t].join();
+            }
+            double seconds = elapsed(start);
+
+            double rate = computed.load() / seconds;
+            if (threads == 1)
+            {
+                singleRate = rate;
+            }
+            report.begin("concurrent")
+                .field("threads", threads)
+                .field("reloading", reloading ? "true" : "false")
+                .field("reload_requests", reloads)
+                .field("magnitudes_per_second", rate)
+                .field("speedup", rate / singleRate)
+                .mismatches("mismatches", mismatches.load())
+                .end();
+        }
+    }
+}
+
+void usage(const char *program)
+{
+    std::cerr
+        << "Usage: " << program << " --regions FILE [options]" << std::endl
+        << std::endl
+        << "  --regions FILE     bna file with West, East and South zones" << std::endl
+        << "  --output FILE      write the JSON lines to FILE instead of stdout" << std::endl
+        << "  --label TEXT       label added to every result, e.g. the plugin version" << std::endl
+        << "  --origins N        number of synthetic origins (default 2000)" << std::endl
+        << "  --stations N       station amplitudes per origin (default 300)" << std::endl
+        << "  --outside F        fraction of origins anywhere on the globe (default 0.2)" << std::endl
+        << "  --seed N           random seed (default 42)" << std::endl
+        << "  --threads N        most threads of the concurrency test (default" << std::endl
+        << "                     the number of cores, at least 4)" << std::endl
+        << "  --time S           minimum run time of every measurement (default 0.5)" << std::endl
+        << std::endl
+        << "The exit status is 1 if any result differs from its reference." << std::endl;
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        const char *value = argv[++i];
+        if (arg == "--regions") options.regionFile = value;
+        else if (arg == "--output") options.outputFile = value;
+        else if (arg == "--label") options.label = value;
+        else if (arg == "--origins") options.origins = atoi(value);
+        else if (arg == "--stations") options.stations = atoi(value);
+        else if (arg == "--outside") options.outsideFraction = atof(value);
+        else if (arg == "--seed") options.seed = atoi(value);
+        else if (arg == "--threads") options.threads = atoi(value);
+        else if (arg == "--time") options.runTime = atof(value);
+        else return false;
+    }
+
+    return !options.regionFile.empty() && options.origins > 0 && options.stations > 0 &&
+           options.threads > 0 && options.runTime >= 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    minimumRunTime = options.runTime;
+
+    std::ofstream file;
+    if (!options.outputFile.empty())
+    {
+        file.open(options.outputFile.c_str());
+        if (!file)
+        {
+            std::cerr << "Can not write " << options.outputFile << std::endl;
+            return 1;
+        }
+    }
+    Report report(options.outputFile.empty() ? std::cout : file, options.label);
+
+    Seiscomp::Config::Config config;
+    Seiscomp::Util::KeyValues keys;
+    keys.setString("mla.regionfilepath", options.regionFile);
+    keys.setString("mla.attenuationTable", "true");
+    Seiscomp::Processing::Settings settings(
+        "mla_bench", "XX", "BENCH", "", "HHZ", &config, &keys);
+
+    Seiscomp::Util::KeyValues exactKeys;
+    exactKeys.setString("mla.regionfilepath", options.regionFile);
+    exactKeys.setString("mla.attenuationTable", "false");
+    Seiscomp::Processing::Settings exactSettings(
+        "mla_bench", "XX", "BENCH", "", "HHZ", &config, &exactKeys);
+
+    Magnitude_MLA processor, exact;
+    if (!processor.setup(settings) || !exact.setup(exactSettings))
+    {
+        std::cerr << "Can not set up the MLa magnitude processor with "
+                  << options.regionFile << std::endl;
+        return 1;
+    }
+
+    std::vector<SyntheticOrigin> origins = makeOrigins(options);
+
+    benchLoad(report, options.regionFile, origins);
+    MLaRegionSetPtr regions = MLaRegionStore::acquire(options.regionFile);
+    benchLookup(report, options.regionFile, regions, origins);
+    benchRaster(report, regions, origins);
+    benchMagnitude(report, processor, exact, origins);
+    benchAmplitude(report, options);
+    benchDecimation(report, options);
+    benchNetwork(report, options);
+    benchConcurrent(report, options, origins);
+
+    return report.failures() > 0 ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+#include "bufferpool.h"
+
+#include <mutex>
+
+
+namespace {
+
+// Buffers of 2^MinClass to 2^MaxClass samples are pooled, smaller ones are
+// cheap to allocate and larger ones are rare.
+const int MinClass = 10;
+const int MaxClass = 26;
+
+std::mutex poolMutex;
+std::vector<MLaBufferPool::Buffer> idle[MaxClass + 1];
+size_t poolReuses = 0;
+size_t poolAllocations = 0;
+
+// Returns the smallest class holding samples samples.
+int classOf(size_t samples)
+{
+    int c = MinClass;
+    while (c < MaxClass && ((size_t)1 << c) < samples)
+    {
+        c++;
+    }
+    return c;
+}
+
+}
+
+void MLaBufferPool::acquire(size_t samples, Buffer &buffer)
+{
+    const int c = classOf(samples);
+    if (((size_t)1 << c) < samples)
+    {
+        // Too large to be pooled.
+        buffer.reserve(samples);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (!idle[c].empty())
+        {
+            buffer.swap(idle[c].back());
+            idle[c].pop_back();
+            poolReuses++;
+            return;
+        }
+        poolAllocations++;
+    }
+
+    // Allocate outside of the lock.
+    Buffer allocated;
+    allocated.reserve((size_t)1 << c);
+    buffer.swap(allocated);
+}
+
+void MLaBufferPool::release(Buffer &buffer)
+{
+    // The largest class the buffer can serve, it may have grown beyond the
+    // size it was acquired for.
+    const size_t capacity = buffer.capacity();
+    int c = classOf(capacity);
+    if (((size_t)1 << c) > capacity)
+    {
+        c--;
+    }
+
+    Buffer released;
+    buffer.swap(released);
+    released.clear();
+    if (c < MinClass)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (idle[c].size() < MaxIdle)
+    {
+        idle[c].push_back(Buffer());
+        idle[c].back().swap(released);
+    }
+}
+
+size_t MLaBufferPool::reuses()
+{
+    std::lock_guard<std::mutex> lock(poolMutex);
+    return poolReuses;
+}
+
+size_t MLaBufferPool::allocations()
+{
+    std::lock_guard<std::mutex> lock(poolMutex);
+    return poolAllocations;
+}
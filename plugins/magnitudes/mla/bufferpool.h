@@ -0,0 +1,63 @@
+/*
+ * File:   bufferpool.h
+ */
+
+#ifndef __MLA_BUFFERPOOL_H__
+#define __MLA_BUFFERPOOL_H__
+
+#include <vector>
+
+#include <stddef.h>
+
+/*
+Process wide pool of sample buffers. Amplitude_MLA takes the buffer of its
+continuous data from here before the first record, large enough for its
+whole safety time window at the rate the data is processed at, and returns
+it when destroyed. The next processor of any stream with a window of about
+the same size then reuses it, instead of growing a new buffer through a
+series of reallocations (and page faults, as buffers of this size are
+mapped and unmapped every time) for every trigger.
+
+Buffers are kept in power of two size classes, at most MaxIdle per class,
+further ones are freed. The records and arrays of decimated data do not come
+from here, every processor reuses its own, see Amplitude_MLA::feedDecimated().
+*/
+class MLaBufferPool
+{
+    public:
+
+        typedef std::vector<double> Buffer;
+
+        // Largest number of idle buffers kept per size class.
+        static const size_t MaxIdle = 32;
+
+        /*
+        Replaces a buffer by an empty one with room for a number of samples.
+
+        @param samples: The number of samples needed.
+        @param buffer: The buffer, which has to be empty. It receives an idle
+                       buffer of the pool if there is one, a new one
+                       otherwise.
+        */
+        static void acquire(size_t samples, Buffer &buffer);
+
+        /*
+        Returns a buffer to the pool.
+
+        @param buffer: The buffer, it is left empty without storage.
+        */
+        static void release(Buffer &buffer);
+
+        // Returns the number of buffers taken from the pool, i.e. the
+        // allocations avoided, so far.
+        static size_t reuses();
+
+        // Returns the number of buffers allocated by acquire() so far.
+        static size_t allocations();
+
+    private:
+
+        MLaBufferPool();
+};
+
+#endif /* __MLA_BUFFERPOOL_H__ */
@@ -0,0 +1,46 @@
+/*
+ * File:   coefficients.h
+ */
+
+#ifndef __MLA_COEFFICIENTS_H__
+#define __MLA_COEFFICIENTS_H__
+
+/*
+Coefficients of the general MLa formula
+
+    MLa = c0*log10(A) + c1*log10(R*c3 + c4) + c5*(R + c6) + c2
+
+where A is the amplitude from vertical component as a maximum displacement in
+millimetres of Wood-Anderson instrument and R is the hypocentral distance in
+kilometres.
+*/
+struct MLaCoefficients
+{
+    double c0, c1, c2, c3, c4, c5, c6;
+};
+
+/*
+West region (Western Australia):
+log10(A)+1.137log10(R)+0.000657*R+0.66
+*/
+constexpr MLaCoefficients MLaWestCoefficients = {
+    1.0, 1.137, 0.66, 1.0, 0.0, 0.000657, 0.0
+};
+
+/*
+East region (Eastern Australia):
+log10(A)+1.34log10(R/100)+0.00055*(R-100)+3.13
+*/
+constexpr MLaCoefficients MLaEastCoefficients = {
+    1.0, 1.34, 3.13, 0.01, 0.0, 0.00055, -100.0
+};
+
+/*
+South region (Flinders Ranges):
+log10(A)+1.1log10(R)+0.0013*R+0.7
+*/
+constexpr MLaCoefficients MLaSouthCoefficients = {
+    1.0, 1.1, 0.7, 1.0, 0.0, 0.0013, 0.0
+};
+
+#endif /* __MLA_COEFFICIENTS_H__ */
@@ -0,0 +1,263 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "compiledregions.h"
+
+#include <fstream>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+// 64 bit FNV-1a.
+uint64_t checksum(const unsigned char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+}
+
+MLaCompiledRegionSet::MLaCompiledRegionSet(const std::string &path,
+                                           const MLaFileVersion &version)
+    : MLaRegionSet(path, version), m_category(1)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+bool MLaCompiledRegionSet::isCompiled(const std::string &file)
+{
+    char magic[sizeof(MLaCompiledMagic)];
+    std::ifstream in(file.c_str(), std::ios::binary);
+    return in.read(magic, sizeof(magic)) &&
+           memcmp(magic, MLaCompiledMagic, sizeof(magic)) == 0;
+}
+
+std::shared_ptr<MLaCompiledRegionSet> MLaCompiledRegionSet::open(
+    const std::string &file, const std::string &path, const MLaFileVersion &version,
+    std::string &error)
+{
+    std::shared_ptr<MLaCompiledRegionSet> regions;
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = strerror(errno);
+        return regions;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(MLaCompiledHeader))
+    {
+        close(fd);
+        error = "file too short";
+        return regions;
+    }
+
+    // Read in one go, the contents are only needed until the features are
+    // built. Doubles keep the records aligned.
+    const size_t size = info.st_size;
+    std::vector<double> buffer((size + sizeof(double) - 1) / sizeof(double));
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = read(fd, (char*)buffer.data() + done, size - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            error = n < 0 ? strerror(errno) : "file truncated while reading";
+            close(fd);
+            return regions;
+        }
+        done += n;
+    }
+    close(fd);
+
+    regions.reset(new MLaCompiledRegionSet(path, version));
+
+    const unsigned char *bytes = (const unsigned char*)buffer.data();
+    const MLaCompiledHeader *header = (const MLaCompiledHeader*)bytes;
+    if (memcmp(header->magic, MLaCompiledMagic, sizeof(MLaCompiledMagic)) != 0)
+    {
+        error = "not a compiled region file";
+        return std::shared_ptr<MLaCompiledRegionSet>();
+    }
+    if (header->version != MLaCompiledVersion ||
+        header->byteOrder != MLaCompiledByteOrder)
+    {
+        error = "unsupported version or byte order";
+        return std::shared_ptr<MLaCompiledRegionSet>();
+    }
+
+    // Widened so that corrupt counts can not overflow.
+    const uint64_t expected = sizeof(MLaCompiledHeader) +
+        (uint64_t)header->regionCount * sizeof(MLaCompiledRegion) +
+        (uint64_t)header->vertexCount * sizeof(MLaCompiledVertex) +
+        header->nameBytes;
+    if (expected != size)
+    {
+        error = "size does not match the header";
+        return std::shared_ptr<MLaCompiledRegionSet>();
+    }
+
+    if (checksum(bytes + sizeof(MLaCompiledHeader),
+                 size - sizeof(MLaCompiledHeader)) != header->checksum)
+    {
+        error = "checksum mismatch";
+        return std::shared_ptr<MLaCompiledRegionSet>();
+    }
+
+    regions->m_header = *header;
+    const MLaCompiledRegion *records = (const MLaCompiledRegion*)(header + 1);
+    const MLaCompiledVertex *vertices = (const MLaCompiledVertex*)(records + header->regionCount);
+    const char *names = (const char*)(vertices + header->vertexCount);
+
+    std::vector<MLaRegionIndex::BoundingBox> boxes(header->regionCount);
+    regions->m_names.reserve(header->regionCount);
+    regions->m_features.reserve(header->regionCount);
+    for (uint32_t i = 0; i < header->regionCount; i++)
+    {
+        const MLaCompiledRegion &region = records[i];
+        if ((uint64_t)region.firstVertex + region.vertexCount > header->vertexCount ||
+            (uint64_t)region.nameOffset + region.nameLength > header->nameBytes)
+        {
+            error = "region out of bounds";
+            return std::shared_ptr<MLaCompiledRegionSet>();
+        }
+
+        boxes[i].latMin = region.latMin;
+        boxes[i].latMax = region.latMax;
+        boxes[i].lonMin = region.lonMin;
+        boxes[i].lonMax = region.lonMax;
+        regions->m_names.push_back(std::string(names + region.nameOffset, region.nameLength));
+
+        Seiscomp::Geo::GeoFeature *feature = new Seiscomp::Geo::GeoFeature(
+            regions->m_names.back(), &regions->m_category, 1);
+        regions->m_features.push_back(std::unique_ptr<Seiscomp::Geo::GeoFeature>(feature));
+        for (uint32_t v = 0; v < region.vertexCount; v++)
+        {
+            const MLaCompiledVertex &vertex = vertices[region.firstVertex + v];
+            feature->addVertex(Seiscomp::Geo::Vertex(vertex.lat, vertex.lon));
+        }
+        feature->setClosedPolygon(true);
+        feature->updateBoundingBox();
+    }
+    regions->m_index.build(boxes);
+
+    return regions;
+}
+
+bool MLaCompiledRegionSet::write(const std::string &file,
+                                 const Seiscomp::Geo::GeoFeatureSet &features,
+                                 const MLaRegionIndex &index,
+                                 const MLaFileVersion &source, std::string &error)
+{
+    const std::vector<Seiscomp::Geo::GeoFeature*> &list = features.features();
+    if (index.size() != list.size())
+    {
+        error = "the index does not belong to the features";
+        return false;
+    }
+
+    std::vector<MLaCompiledRegion> regions(list.size());
+    std::vector<MLaCompiledVertex> vertices;
+    std::string names;
+    for (size_t i = 0; i < list.size(); i++)
+    {
+        const Seiscomp::Geo::GeoFeature *feature = list[i];
+        if (!feature->closedPolygon() || !feature->subFeatures().empty())
+        {
+            error = "region " + feature->name() +
+                    " is not a single closed polygon, which is not supported";
+            return false;
+        }
+
+        const MLaRegionIndex::BoundingBox &box = index.box(i);
+        MLaCompiledRegion &region = regions[i];
+        region.latMin = box.latMin;
+        region.latMax = box.latMax;
+        region.lonMin = box.lonMin;
+        region.lonMax = box.lonMax;
+        region.firstVertex = vertices.size();
+        region.vertexCount = feature->vertices().size();
+        region.nameOffset = names.size();
+        region.nameLength = feature->name().size();
+
+        for (size_t v = 0; v < feature->vertices().size(); v++)
+        {
+            MLaCompiledVertex vertex = { feature->vertices()[v].lat,
+                                         feature->vertices()[v].lon };
+            vertices.push_back(vertex);
+        }
+        names += feature->name();
+    }
+
+    std::string payload;
+    payload.append((const char*)regions.data(), regions.size() * sizeof(MLaCompiledRegion));
+    payload.append((const char*)vertices.data(), vertices.size() * sizeof(MLaCompiledVertex));
+    payload.append(names);
+
+    MLaCompiledHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MLaCompiledMagic, sizeof(MLaCompiledMagic));
+    header.version = MLaCompiledVersion;
+    header.byteOrder = MLaCompiledByteOrder;
+    header.regionCount = regions.size();
+    header.vertexCount = vertices.size();
+    header.nameBytes = names.size();
+    header.sourceMtime = source.mtime;
+    header.sourceSize = source.size;
+    header.checksum = checksum((const unsigned char*)payload.data(), payload.size());
+
+    const std::string temporary = file + ".tmp";
+    {
+        std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+        out.write((const char*)&header, sizeof(header));
+        out.write(payload.data(), payload.size());
+        out.close();
+        if (!out)
+        {
+            unlink(temporary.c_str());
+            error = "can not write " + temporary;
+            return false;
+        }
+    }
+
+    if (rename(temporary.c_str(), file.c_str()) != 0)
+    {
+        error = "can not rename " + temporary + ": " + strerror(errno);
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool MLaCompiledRegionSet::contains(int region, const Seiscomp::Geo::Vertex &location) const
+{
+    return m_features[region]->contains(location);
+}
+
+int MLaCompiledRegionSet::find(const Seiscomp::Geo::Vertex &location) const
+{
+    Contains contains = { this, &location };
+    return m_index.find(location, contains);
+}
+
+void MLaCompiledRegionSet::polygons(size_t region, Polygons &polygons) const
+{
+    polygons.assign(1, m_features[region]->vertices());
+}
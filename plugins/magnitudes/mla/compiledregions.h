@@ -0,0 +1,155 @@
+/*
+ * File:   compiledregions.h
+ */
+
+#ifndef __MLA_COMPILEDREGIONS_H__
+#define __MLA_COMPILEDREGIONS_H__
+
+#include "regionstore.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// Appended to the path of a bna file to get the path of its compiled file.
+const char * const MLaCompiledRegionSuffix = ".compiled";
+
+/*
+Layout of a compiled region file. All values are stored in the byte order of
+the machine which compiled the file, a file is rejected on machines with
+another byte order.
+
+    MLaCompiledHeader
+    MLaCompiledRegion   regions[regionCount]
+    MLaCompiledVertex   vertices[vertexCount]   polygons one after another
+    char                names[nameBytes]        not terminated
+
+The checksum covers everything after the header.
+*/
+struct MLaCompiledHeader
+{
+    char        magic[8];       // MLaCompiledMagic
+    uint32_t    version;        // MLaCompiledVersion
+    uint32_t    byteOrder;      // MLaCompiledByteOrder
+    uint32_t    regionCount;
+    uint32_t    vertexCount;
+    uint32_t    nameBytes;
+    uint32_t    reserved;
+    // Version of the bna file which was compiled, see MLaFileVersion.
+    int64_t     sourceMtime;    // nanoseconds
+    uint64_t    sourceSize;
+    // FNV-1a over the payload.
+    uint64_t    checksum;
+};
+
+struct MLaCompiledRegion
+{
+    // Bounding box as computed by MLaRegionIndex, infinite bounds if the
+    // region is not indexed.
+    double      latMin, latMax;
+    double      lonMin, lonMax;
+    uint32_t    firstVertex;
+    uint32_t    vertexCount;
+    uint32_t    nameOffset;
+    uint32_t    nameLength;
+};
+
+struct MLaCompiledVertex
+{
+    float       lat;
+    float       lon;
+};
+
+const char MLaCompiledMagic[8] = { 'M', 'L', 'A', 'R', 'E', 'G', 'N', '\0' };
+const uint32_t MLaCompiledVersion = 2;
+const uint32_t MLaCompiledByteOrder = 0x01020304;
+
+/*
+A region set loaded from a compiled region file. Loading it does not parse
+any text: the file is read in one go and checked, a GeoFeature is built from
+the vertices of each region and the spatial index is rebuilt from the stored
+bounding boxes. Locations are tested by GeoFeature::contains() like in a
+region set read from the bna file, and the vertices are the same single
+precision values, so both give the same results. The region set holds its
+own copy of the vertices, processes do not share them.
+*/
+class MLaCompiledRegionSet : public MLaRegionSet
+{
+    public:
+
+        /*
+        Loads a compiled region file.
+
+        @param file: Path of the compiled file.
+        @param path: Path the region set is known by, see path().
+        @param version: Version of the file the region set is known by.
+        @param error: Set to the reason if the file can not be used.
+        @returns The region set or an empty pointer.
+        */
+        static std::shared_ptr<MLaCompiledRegionSet> open(
+            const std::string &file, const std::string &path, const MLaFileVersion &version,
+            std::string &error
+        );
+
+        /*
+        Returns whether a file starts like a compiled region file.
+
+        @param file: Path of the file.
+        */
+        static bool isCompiled(const std::string &file);
+
+        /*
+        Writes a compiled region file. The file is written under a temporary
+        name first and renamed, so that readers never see a partial file.
+
+        @param file: Path of the compiled file.
+        @param features: The regions read from the bna file.
+        @param index: The index built over the features.
+        @param source: Version of the bna file.
+        @param error: Set to the reason if the file could not be written.
+        @returns Whether the file was written.
+        */
+        static bool write(const std::string &file,
+                          const Seiscomp::Geo::GeoFeatureSet &features,
+                          const MLaRegionIndex &index,
+                          const MLaFileVersion &source, std::string &error);
+
+        // Returns the header of the loaded file.
+        const MLaCompiledHeader &header() const { return m_header; }
+
+        // Tests a location against the polygon of a region with
+        // GeoFeature::contains().
+        bool contains(int region, const Seiscomp::Geo::Vertex &location) const;
+
+        size_t size() const { return m_names.size(); }
+        const std::string &name(size_t region) const { return m_names[region]; }
+        int find(const Seiscomp::Geo::Vertex &location) const;
+        void polygons(size_t region, Polygons &polygons) const;
+
+    private:
+
+        MLaCompiledRegionSet(const std::string &path, const MLaFileVersion &version);
+
+        // Calls contains() for MLaRegionIndex::find().
+        struct Contains
+        {
+            const MLaCompiledRegionSet      *regions;
+            const Seiscomp::Geo::Vertex     *location;
+
+            bool operator()(int region) const
+            {
+                return regions->contains(region, *location);
+            }
+        };
+
+        MLaCompiledHeader            m_header;
+        std::vector<std::string>     m_names;
+        // Declared before m_features, which refer to it.
+        Seiscomp::Geo::Category      m_category;
+        std::vector< std::unique_ptr<Seiscomp::Geo::GeoFeature> > m_features;
+        MLaRegionIndex               m_index;
+};
+
+#endif /* __MLA_COMPILEDREGIONS_H__ */
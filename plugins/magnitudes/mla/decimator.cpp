@@ -0,0 +1,154 @@
+#include "decimator.h"
+
+#include <algorithm>
+#include <math.h>
+
+
+const double MLaDecimator::PassbandRipple = 1E-3;
+const double MLaDecimator::StopbandAttenuation = 60;
+
+namespace {
+
+// Modified Bessel function of the first kind of order 0, for the window.
+double besselI0(double x)
+{
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; k < 50; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1E-17)
+        {
+            break;
+        }
+    }
+    return sum;
+}
+
+}
+
+MLaDecimator::MLaDecimator()
+    : m_inputRate(1), m_factor(1)
+{
+    reset();
+}
+
+int MLaDecimator::decimationFactor(double inputRate, double targetRate)
+{
+    if (!(inputRate > 0) || !(targetRate > 0))
+    {
+        return 1;
+    }
+
+    // Allow for rates like 199.99 Hz given for 200 Hz.
+    return std::max(1, (int)floor(inputRate / targetRate + 1E-6));
+}
+
+bool MLaDecimator::configure(double inputRate, double targetRate)
+{
+    m_inputRate = inputRate;
+    m_factor = 1;
+    m_taps.clear();
+    reset();
+
+    const int factor = decimationFactor(inputRate, targetRate);
+    if (factor < 2)
+    {
+        return false;
+    }
+    m_factor = factor;
+
+    // Kaiser's estimates of the window shape and length for the attenuation
+    // (the ripple is the same in both bands) and for the transition from 0.4
+    // to 0.6 times the output rate, which is the widest one keeping aliases
+    // out of the passband.
+    const double a = StopbandAttenuation;
+    const double beta = 0.1102 * (a - 8.7);
+    const double width = 2 * M_PI * 0.2 / factor;
+    const int half = (int)ceil((a - 7.95) / (2.285 * width) / 2);
+
+    // Cut off half way through the transition, at the output Nyquist rate.
+    const double cutoff = 0.5 / factor;
+    const double norm = besselI0(beta);
+    m_taps.resize(half + 1);
+    double sum = 0;
+    for (int k = 0; k <= half; k++)
+    {
+        double x = 2 * M_PI * cutoff * k;
+        double sinc = k == 0 ? 1 : sin(x) / x;
+        double r = (double)k / half;
+        m_taps[k] = 2 * cutoff * sinc * besselI0(beta * sqrt(1 - r * r)) / norm;
+        sum += k == 0 ? m_taps[k] : 2 * m_taps[k];
+    }
+
+    // Keep offsets as they are.
+    for (int k = 0; k <= half; k++)
+    {
+        m_taps[k] /= sum;
+    }
+
+    return true;
+}
+
+void MLaDecimator::reset()
+{
+    m_window.clear();
+    m_windowStart = 0;
+    m_received = 0;
+    m_next = 0;
+}
+
+long MLaDecimator::process(const double *samples, size_t count,
+                           std::vector<double> &output)
+{
+    output.clear();
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    const long half = (long)m_taps.size() - 1;
+    const long first = m_received;
+    if (m_received == 0)
+    {
+        // Extend the stream backwards with its first sample.
+        m_window.assign(half, samples[0]);
+        m_windowStart = -half;
+    }
+    m_window.insert(m_window.end(), samples, samples + count);
+    m_received += count;
+
+    const long start = m_next;
+    const double *taps = &m_taps[0];
+    while (m_next + half < m_received)
+    {
+        // Four independent sums keep the adds from waiting for each other.
+        const double *center = &m_window[m_next - m_windowStart];
+        double sums[4] = { taps[0] * center[0], 0, 0, 0 };
+        long k = 1;
+        for (; k + 3 <= half; k += 4)
+        {
+            sums[0] += taps[k] * (center[-k] + center[k]);
+            sums[1] += taps[k + 1] * (center[-k - 1] + center[k + 1]);
+            sums[2] += taps[k + 2] * (center[-k - 2] + center[k + 2]);
+            sums[3] += taps[k + 3] * (center[-k - 3] + center[k + 3]);
+        }
+        for (; k <= half; k++)
+        {
+            sums[0] += taps[k] * (center[-k] + center[k]);
+        }
+        output.push_back((sums[0] + sums[1]) + (sums[2] + sums[3]));
+        m_next += m_factor;
+    }
+
+    // Drop the samples no later output needs.
+    long unused = m_next - half - m_windowStart;
+    if (unused > 0)
+    {
+        m_window.erase(m_window.begin(), m_window.begin() + unused);
+        m_windowStart += unused;
+    }
+
+    return start - first;
+}
@@ -0,0 +1,109 @@
+/*
+ * File:   decimator.h
+ */
+
+#ifndef __MLA_DECIMATOR_H__
+#define __MLA_DECIMATOR_H__
+
+#include <vector>
+
+#include <stddef.h>
+
+/*
+Anti-alias filter and integer decimation of a continuous stream of samples.
+The filter is a linear phase, Kaiser windowed sinc FIR: the band up to 0.4
+times the output rate is kept within PassbandRipple, what would fold into it
+is attenuated by at least StopbandAttenuation dB. Only the output samples
+are computed, with the symmetry of the filter halving the multiplications,
+which comes to about 9 multiplications per input sample for any factor.
+
+Output sample k is at the time of input sample k * factor(), i.e. the filter
+delay is compensated, but it needs the input up to delay() samples later.
+Before the first sample the stream is extended with the value of that
+sample, so the output starts with the input and the filter has no transient
+for a stream starting on its offset.
+
+Compared to the native rate, Wood-Anderson peaks of decimated streams are
+smaller, mostly because the peak falls between samples more often and the
+simulation is coarser. For synthetic 200, 250 and 500 Hz records, the mean
+(largest) differences were below 0.003 (0.007) magnitude units for signals
+of up to 3 Hz and 0.013 (0.044) up to 8 Hz at 100 Hz, and 0.008 (0.020) up to
+3 Hz and 0.046 (0.16) up to 8 Hz at 50 Hz.
+*/
+class MLaDecimator
+{
+    public:
+
+        // Largest deviation from a gain of 1 in the passband.
+        static const double PassbandRipple;
+
+        // Smallest attenuation (in dB) of the frequencies folding into the
+        // passband.
+        static const double StopbandAttenuation;
+
+        MLaDecimator();
+
+        /*
+        Returns the factor configure() chooses for a pair of rates, 1 if the
+        input is not to be decimated.
+        */
+        static int decimationFactor(double inputRate, double targetRate);
+
+        /*
+        Designs the filter for an input rate and a target rate. The factor is
+        the largest integer which keeps the output rate at or above the
+        target rate.
+
+        @param inputRate: The sampling rate of the input (in Hz).
+        @param targetRate: The lowest acceptable output rate (in Hz).
+        @returns false if there is no factor of at least 2, the input is
+                 then not to be decimated.
+        */
+        bool configure(double inputRate, double targetRate);
+
+        // Returns the decimation factor, 1 if not configured.
+        int factor() const { return m_factor; }
+
+        // Returns the sampling rate of the output (in Hz).
+        double outputRate() const { return m_inputRate / m_factor; }
+
+        // Returns the number of input samples an output sample waits for.
+        int delay() const { return (int)m_taps.size() - 1; }
+
+        // Starts a new stream, e.g. after a gap.
+        void reset();
+
+        /*
+        Filters and decimates the next samples of the stream.
+
+        @param samples: The samples.
+        @param count: The number of samples.
+        @param output: Receives the output samples which became complete.
+        @returns The position of the first output sample relative to the
+                 first input sample of this call, in input samples. It is
+                 zero or negative as outputs lag behind by up to delay()
+                 samples.
+        */
+        long process(const double *samples, size_t count,
+                     std::vector<double> &output);
+
+    private:
+
+        double              m_inputRate;
+        int                 m_factor;
+
+        // Half of the symmetric filter, m_taps[k] weighting the samples k
+        // before and after the output sample.
+        std::vector<double> m_taps;
+
+        // Input samples still needed, the first one at stream position
+        // m_windowStart.
+        std::vector<double> m_window;
+        long                m_windowStart;
+
+        // Stream position of the next input and output sample.
+        long                m_received;
+        long                m_next;
+};
+
+#endif /* __MLA_DECIMATOR_H__ */
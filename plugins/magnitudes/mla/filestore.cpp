@@ -0,0 +1,45 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "filestore.h"
+
+#include <seiscomp/logging/log.h>
+
+#include <sstream>
+#include <limits.h>
+#include <stdlib.h>
+
+
+bool MLaFileStore::resolve(const std::string &filePath, std::string &path,
+                           MLaFileVersion &version)
+{
+    char resolved[PATH_MAX];
+    struct stat info;
+    if (realpath(filePath.c_str(), resolved) == NULL ||
+        stat(resolved, &info) != 0)
+    {
+        return false;
+    }
+
+    path = resolved;
+    version = MLaFileVersion(info);
+    return true;
+}
+
+std::string MLaFileStore::key(const std::string &path, const MLaFileVersion &version)
+{
+    std::ostringstream key;
+    key << path << '@' << version.mtime << ':' << version.size;
+    return key.str();
+}
+
+void MLaFileStore::logReload(const char *what, const std::string &filePath, bool reloaded)
+{
+    if (reloaded)
+    {
+        SEISCOMP_INFO("MLa %s %s reloaded", what, filePath.c_str());
+    }
+    else
+    {
+        SEISCOMP_WARNING("Keeping the previous version of the %s %s", what, filePath.c_str());
+    }
+}
@@ -0,0 +1,347 @@
+/*
+ * File:   filestore.h
+ */
+
+#ifndef __MLA_FILESTORE_H__
+#define __MLA_FILESTORE_H__
+
+#include "filewatcher.h"
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+A version of a file: its modification time in nanoseconds and its size.
+st_mtime alone has a resolution of one second and misses a file rewritten
+within the second it was read in.
+*/
+struct MLaFileVersion
+{
+    MLaFileVersion() : mtime(0), size(0) {}
+
+    explicit MLaFileVersion(const struct stat &info)
+        : mtime((int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec),
+          size(info.st_size) {}
+
+    bool operator==(const MLaFileVersion &other) const
+    {
+        return mtime == other.mtime && size == other.size;
+    }
+
+    bool operator!=(const MLaFileVersion &other) const
+    {
+        return !(*this == other);
+    }
+
+    // Modification time in nanoseconds since the epoch.
+    int64_t     mtime;
+    uint64_t    size;
+};
+
+/*
+The parts of the file stores (MLaFileCache and MLaFileWatch) which do not
+depend on the type of the objects read from the files.
+*/
+class MLaFileStore
+{
+    public:
+
+        /*
+        Resolves the configured path of a file.
+
+        @param filePath: Path of the file as configured.
+        @param path: Set to the canonical path.
+        @param version: Set to the current version of the file.
+        @returns Whether the file exists.
+        */
+        static bool resolve(const std::string &filePath, std::string &path,
+                            MLaFileVersion &version);
+
+        // Returns the cache key of a version of a file.
+        static std::string key(const std::string &path, const MLaFileVersion &version);
+
+        /*
+        Logs the outcome of reading a watched file again.
+
+        @param what: Names the kind of file, e.g. "region file".
+        @param filePath: Path of the file as configured.
+        @param reloaded: Whether the file was read, otherwise the previous
+                         version is kept.
+        */
+        static void logReload(const char *what, const std::string &filePath, bool reloaded);
+
+    private:
+
+        MLaFileStore();
+};
+
+/*
+Objects read from files, shared by everyone asking for the same version of
+the same file: a map from a key naming the canonical path and version of the
+file (see MLaFileStore::key()), and whatever else the object was read with,
+to a weak reference. An object is released with its last holder and its key
+dropped when the next object is added.
+*/
+template <typename T>
+class MLaFileCache
+{
+    public:
+
+        typedef std::shared_ptr<const T> Pointer;
+
+        /*
+        Returns the object of a key, calling load to read it if no object of
+        the key is held or if reread is set. Loading is serialised, so a file
+        is read once however many threads ask for it at once.
+
+        @param key: The key of the object.
+        @param reread: Whether to read the object even if it is held.
+        @param load: Reads the object, returns an empty pointer on failure.
+        @returns The object or an empty pointer.
+        */
+        Pointer acquire(const std::string &key, bool reread,
+                        const std::function<Pointer()> &load)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            Pointer object;
+            if (!reread)
+            {
+                typename Map::const_iterator it = m_objects.find(key);
+                if (it != m_objects.end())
+                {
+                    object = it->second.lock();
+                }
+            }
+            if (object)
+            {
+                return object;
+            }
+
+            object = load();
+            if (!object)
+            {
+                return object;
+            }
+            m_objects[key] = object;
+
+            // Forget about versions of files no one holds anymore.
+            for (typename Map::iterator it = m_objects.begin(); it != m_objects.end(); )
+            {
+                if (it->second.expired())
+                {
+                    m_objects.erase(it++);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            return object;
+        }
+
+    private:
+
+        typedef std::map<std::string, std::weak_ptr<const T> > Map;
+
+        std::mutex                      m_mutex;
+        Map                             m_objects;
+};
+
+// The spec of files which are read the same way by everyone.
+struct MLaNoSpec
+{
+    bool operator==(const MLaNoSpec &) const { return true; }
+};
+
+/*
+A file watched for changes, e.g. a bna region file (see MLaRegionStore) or a
+station correction file (see MLaStationCorrectionStore). The watcher thread
+(see MLaFileWatcher) reads a changed file in the background and then
+publishes the new object here, increasing the generation. Processors compare
+the generation, a single atomic load, with the one of the object they use
+and switch to the new object between two computations. Objects in use are
+never modified, the old one is released with its last user.
+
+T is the type of the objects read from the file, which tell the path() and
+version() of the file they were read from. Spec is what the objects are read
+with besides the file, e.g. the raster in front of a region set, watches on
+the same file with another spec are distinct.
+*/
+template <typename T, typename Spec>
+class MLaFileWatch
+{
+    public:
+
+        typedef std::shared_ptr<const T> Pointer;
+
+        /*
+        Reads the object of a file.
+
+        @param filePath: Path of the file as configured.
+        @param spec: What the object is read with besides the file.
+        @param reread: Whether to read the file even if an object of its
+                       current version is held already.
+        @returns The object or an empty pointer.
+        */
+        typedef std::function<Pointer(const std::string &filePath, const Spec &spec,
+                                      bool reread)> Acquire;
+
+        /*
+        Returns a watch on a file, which is checked for changes every
+        interval seconds by the watcher thread until the last holder of the
+        watch releases it. All callers asking for the same path and spec
+        share one watch, the interval of the first one applies.
+
+        @param filePath: Path of the file as configured.
+        @param spec: What the objects are read with besides the file.
+        @param interval: Seconds between two checks.
+        @param acquire: Reads the file.
+        @param what: Names the kind of file in the log, e.g. "region file".
+        @returns The watch or an empty pointer if the file could not be
+                 read.
+        */
+        static std::shared_ptr<MLaFileWatch> watch(const std::string &filePath,
+                                                   const Spec &spec, double interval,
+                                                   const Acquire &acquire,
+                                                   const char *what)
+        {
+            // Never destroyed, like the caches of the stores.
+            static std::mutex &watchMutex = *new std::mutex;
+            static std::vector< std::weak_ptr<MLaFileWatch> > &watches =
+                *new std::vector< std::weak_ptr<MLaFileWatch> >;
+
+            std::lock_guard<std::mutex> lock(watchMutex);
+            for (typename std::vector< std::weak_ptr<MLaFileWatch> >::iterator it = watches.begin();
+                 it != watches.end(); )
+            {
+                std::shared_ptr<MLaFileWatch> watch = it->lock();
+                if (!watch)
+                {
+                    it = watches.erase(it);
+                    continue;
+                }
+                if (watch->path() == filePath && watch->spec() == spec)
+                {
+                    return watch;
+                }
+                ++it;
+            }
+
+            Pointer object = acquire(filePath, spec, false);
+            if (!object)
+            {
+                return std::shared_ptr<MLaFileWatch>();
+            }
+
+            std::shared_ptr<MLaFileWatch> watch(
+                new MLaFileWatch(filePath, spec, acquire, what, object));
+            watches.push_back(watch);
+
+            // The watcher only runs the check while it holds the watch.
+            MLaFileWatch *watched = watch.get();
+            MLaFileWatcher::add(watch, interval, [watched](bool force)
+            {
+                watched->reload(force);
+            });
+
+            return watch;
+        }
+
+        // Returns the number of objects published so far.
+        unsigned generation() const
+        {
+            return m_generation.load(std::memory_order_acquire);
+        }
+
+        // Returns the most recent object.
+        Pointer current() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_current;
+        }
+
+        // Returns the path of the file as configured.
+        const std::string &path() const { return m_path; }
+
+        // Returns what the objects are read with besides the file.
+        const Spec &spec() const { return m_spec; }
+
+    private:
+
+        MLaFileWatch(const std::string &path, const Spec &spec, const Acquire &acquire,
+                     const char *what, const Pointer &object)
+            : m_path(path), m_spec(spec), m_acquire(acquire), m_what(what),
+              m_generation(0), m_current(object)
+        {
+        }
+
+        // Publishes a new object.
+        void publish(const Pointer &object)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_current = object;
+            }
+            m_generation.fetch_add(1, std::memory_order_release);
+        }
+
+        // Reads the file again if it changed or if forced to.
+        void reload(bool force)
+        {
+            std::string path;
+            MLaFileVersion version;
+            if (!MLaFileStore::resolve(m_path, path, version))
+            {
+                // Probably being replaced, try again next time.
+                return;
+            }
+
+            // A changed symbolic link counts as a change as well.
+            Pointer current = this->current();
+            if (!force && current->path() == path && current->version() == version)
+            {
+                return;
+            }
+
+            // Do not retry a broken version until it changes again.
+            if (!force && version == m_failedVersion)
+            {
+                return;
+            }
+
+            Pointer object = m_acquire(m_path, m_spec, force);
+            if (!object)
+            {
+                m_failedVersion = version;
+                MLaFileStore::logReload(m_what, m_path, false);
+                return;
+            }
+
+            m_failedVersion = MLaFileVersion();
+            publish(object);
+            MLaFileStore::logReload(m_what, m_path, true);
+        }
+
+        const std::string               m_path;
+        const Spec                      m_spec;
+        const Acquire                   m_acquire;
+        const char * const              m_what;
+        std::atomic<unsigned>           m_generation;
+        mutable std::mutex              m_mutex;
+        Pointer                         m_current;
+
+        // Version of the file which could not be read, owned by the
+        // watcher thread.
+        MLaFileVersion                  m_failedVersion;
+};
+
+#endif /* __MLA_FILESTORE_H__ */
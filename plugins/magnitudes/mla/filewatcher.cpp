@@ -0,0 +1,138 @@
+#include "filewatcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct WatchEntry
+{
+    std::weak_ptr<void>             owner;
+    std::function<void(bool)>       check;
+    Clock::duration                 interval;
+    Clock::time_point               nextCheck;
+};
+
+// A check to run, holding on to its owner meanwhile.
+struct DueCheck
+{
+    std::shared_ptr<void>           owner;
+    std::function<void(bool)>       check;
+};
+
+std::mutex watchMutex;
+std::condition_variable watchWake;
+std::vector<WatchEntry> watchEntries;
+bool watchReloadRequested = false;
+bool watchAdded = false;
+bool watchStop = false;
+
+// Stops the watcher thread when the process exits. Declared last so that it
+// is destroyed before the state the thread uses.
+struct WatchThread
+{
+    ~WatchThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(watchMutex);
+            watchStop = true;
+        }
+        watchWake.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    std::thread thread;
+};
+
+WatchThread watchThread;
+
+}
+
+void MLaFileWatcher::add(const std::shared_ptr<void> &owner, double interval,
+                         const std::function<void(bool)> &check)
+{
+    WatchEntry entry;
+    entry.owner = owner;
+    entry.check = check;
+    entry.interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(interval));
+    entry.nextCheck = Clock::now() + entry.interval;
+
+    {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        watchEntries.push_back(entry);
+        watchAdded = true;
+        if (!watchThread.thread.joinable())
+        {
+            watchThread.thread = std::thread(loop);
+        }
+    }
+    watchWake.notify_all();
+}
+
+void MLaFileWatcher::requestReload()
+{
+    {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        watchReloadRequested = true;
+    }
+    watchWake.notify_all();
+}
+
+void MLaFileWatcher::loop()
+{
+    std::unique_lock<std::mutex> lock(watchMutex);
+    while (!watchStop)
+    {
+        bool force = watchReloadRequested;
+        watchReloadRequested = false;
+        watchAdded = false;
+
+        Clock::time_point now = Clock::now();
+        Clock::time_point next = now + std::chrono::hours(1);
+        std::vector<DueCheck> due;
+        for (std::vector<WatchEntry>::iterator it = watchEntries.begin(); it != watchEntries.end(); )
+        {
+            std::shared_ptr<void> owner = it->owner.lock();
+            if (!owner)
+            {
+                it = watchEntries.erase(it);
+                continue;
+            }
+
+            if (force || it->nextCheck <= now)
+            {
+                DueCheck check = { owner, it->check };
+                due.push_back(check);
+                it->nextCheck = now + it->interval;
+            }
+            next = std::min(next, it->nextCheck);
+            ++it;
+        }
+
+        // Reading a file may take a while, processors setting up watches
+        // must not wait for it.
+        lock.unlock();
+        for (size_t i = 0; i < due.size(); i++)
+        {
+            due[i].check(force);
+        }
+        due.clear();
+        lock.lock();
+
+        watchWake.wait_until(lock, next, []
+        {
+            return watchStop || watchReloadRequested || watchAdded;
+        });
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * File:   filewatcher.h
+ */
+
+#ifndef __MLA_FILEWATCHER_H__
+#define __MLA_FILEWATCHER_H__
+
+#include <functional>
+#include <memory>
+
+/*
+The background thread checking the files MLa reads at runtime, i.e. the bna
+region files (see MLaRegionStore) and the station correction files (see
+MLaStationCorrectionStore), for changes. Every watched file has an owner,
+the object processors hold on to, and a check which reads the file again if
+it changed. A file is watched until its owner is released. The checks run on
+the watcher thread one after the other, so a check may take a while without
+holding up the processors.
+*/
+class MLaFileWatcher
+{
+    public:
+
+        /*
+        Runs the check of a file while the owner is alive.
+
+        @param owner: The owner of the check, only a weak reference is kept.
+        @param interval: Seconds between two checks.
+        @param check: Checks the file, its argument tells whether to read
+                      the file even if it did not change.
+        */
+        static void add(const std::shared_ptr<void> &owner, double interval,
+                        const std::function<void(bool)> &check);
+
+        /*
+        Asks the watcher thread to read all watched files again right away,
+        whether they changed or not.
+        */
+        static void requestReload();
+
+    private:
+
+        MLaFileWatcher();
+
+        // The watcher thread.
+        static void loop();
+};
+
+#endif /* __MLA_FILEWATCHER_H__ */
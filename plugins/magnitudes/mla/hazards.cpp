@@ -0,0 +1,111 @@
+#include "hazards.h"
+
+#include <new>
+#include <stdlib.h>
+
+
+namespace {
+
+/*
+The slots of a thread, on a cache line of their own. Records are never
+freed: the record of a thread which exited is taken over by the next new
+thread.
+*/
+struct alignas(64) Record
+{
+    std::atomic<const void*>    slots[MLaHazards::SlotsPerThread];
+    std::atomic<bool>           active;
+    Record                     *next;
+    // Slots in use, only used by the owning thread.
+    int                         depth;
+};
+
+std::atomic<Record*> records(NULL);
+
+Record *take()
+{
+    for (Record *record = records.load(std::memory_order_acquire); record != NULL;
+         record = record->next)
+    {
+        bool inactive = false;
+        if (!record->active.load(std::memory_order_relaxed) &&
+            record->active.compare_exchange_strong(inactive, true))
+        {
+            return record;
+        }
+    }
+
+    // Aligned to keep the slots of two threads off one cache line.
+    void *memory;
+    if (posix_memalign(&memory, alignof(Record), sizeof(Record)) != 0)
+    {
+        abort();
+    }
+    Record *record = new (memory) Record;
+    for (int i = 0; i < MLaHazards::SlotsPerThread; i++)
+    {
+        record->slots[i].store(NULL, std::memory_order_relaxed);
+    }
+    record->active.store(true, std::memory_order_relaxed);
+    record->depth = 0;
+    record->next = records.load(std::memory_order_relaxed);
+    while (!records.compare_exchange_weak(record->next, record))
+    {
+    }
+    return record;
+}
+
+// Hands the record of a thread back when it exits.
+struct Owner
+{
+    Owner() : record(take()) {}
+
+    ~Owner()
+    {
+        record->depth = 0;
+        record->active.store(false, std::memory_order_release);
+    }
+
+    Record *record;
+};
+
+Record &current()
+{
+    static thread_local Owner owner;
+    return *owner.record;
+}
+
+}
+
+std::atomic<const void*> &MLaHazards::acquire()
+{
+    Record &record = current();
+    if (record.depth >= SlotsPerThread)
+    {
+        // More nested readers than slots is a programming error.
+        abort();
+    }
+    return record.slots[record.depth++];
+}
+
+void MLaHazards::release()
+{
+    // Readers are scoped, so the slot is the last one acquired.
+    current().depth--;
+}
+
+bool MLaHazards::inUse(const void *object)
+{
+    for (Record *record = records.load(std::memory_order_acquire); record != NULL;
+         record = record->next)
+    {
+        for (int i = 0; i < SlotsPerThread; i++)
+        {
+            if (record->slots[i].load(std::memory_order_seq_cst) == object)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
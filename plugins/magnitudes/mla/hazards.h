@@ -0,0 +1,165 @@
+/*
+ * File:   hazards.h
+ */
+
+#ifndef __MLA_HAZARDS_H__
+#define __MLA_HAZARDS_H__
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <stddef.h>
+
+/*
+Hazard pointers: every thread announces the objects it reads in slots of its
+own, and an object is only released once it has been replaced and no slot
+announces it anymore. Readers neither lock nor write to memory shared with
+other threads, so reading scales with the number of threads, while the
+object can be replaced at any time.
+*/
+class MLaHazards
+{
+    public:
+
+        // Largest number of objects one thread may read at once.
+        static const int SlotsPerThread = 4;
+
+        // Returns a free slot of the calling thread.
+        static std::atomic<const void*> &acquire();
+
+        // Frees the slot returned by the last acquire() of the thread.
+        static void release();
+
+        // Returns whether any thread announces an object.
+        static bool inUse(const void *object);
+
+    private:
+
+        MLaHazards();
+};
+
+/*
+An object which is read from several threads at once and replaced now and
+then, e.g. when the file it was read from changed. Readers get the current
+object through a Reader, which keeps it alive until it goes out of scope.
+Replaced objects are retired rather than waited for: they are released by a
+later replace() or reclaim() once no thread reads them anymore, so neither
+readers nor the replacing thread ever block.
+*/
+template <typename T>
+class MLaProtected
+{
+    public:
+
+        typedef std::shared_ptr<const T> Pointer;
+
+        MLaProtected() : m_current(NULL), m_retiredCount(0) {}
+
+        /*
+        Replaces the object and retires the previous one, releasing the
+        retired objects no thread reads anymore. Does not wait for readers.
+        Must not be called concurrently with another replace() or reclaim().
+
+        @param object: The new object, may be empty.
+        */
+        void replace(const Pointer &object)
+        {
+            if (m_owner)
+            {
+                m_retired.push_back(m_owner);
+            }
+            m_owner = object;
+            m_current.store(object.get(), std::memory_order_seq_cst);
+            reclaim();
+        }
+
+        /*
+        Releases the retired objects no thread reads anymore, the others are
+        kept for a later call. Must not be called concurrently with
+        replace() or another reclaim().
+        */
+        void reclaim()
+        {
+            for (size_t i = 0; i < m_retired.size(); )
+            {
+                if (MLaHazards::inUse(m_retired[i].get()))
+                {
+                    i++;
+                    continue;
+                }
+                m_retired[i] = m_retired.back();
+                m_retired.pop_back();
+            }
+            m_retiredCount.store(m_retired.size(), std::memory_order_relaxed);
+        }
+
+        // Returns whether retired objects wait to be released. Any thread
+        // may ask.
+        bool retired() const
+        {
+            return m_retiredCount.load(std::memory_order_relaxed) > 0;
+        }
+
+        // Returns the object. Only for the thread replacing the object.
+        const Pointer &owner() const { return m_owner; }
+
+        // The object while being read.
+        class Reader
+        {
+            public:
+
+                explicit Reader(const MLaProtected &object)
+                    : m_slot(MLaHazards::acquire())
+                {
+                    // Announce the object before using it, and check that it
+                    // was not replaced meanwhile: replace() either sees the
+                    // announcement or the check sees the new object.
+                    const T *current = object.m_current.load(std::memory_order_acquire);
+                    for (;;)
+                    {
+                        m_slot.store(current, std::memory_order_seq_cst);
+                        const T *again = object.m_current.load(std::memory_order_seq_cst);
+                        if (again == current)
+                        {
+                            break;
+                        }
+                        current = again;
+                    }
+                    m_object = current;
+                }
+
+                ~Reader()
+                {
+                    m_slot.store(NULL, std::memory_order_release);
+                    MLaHazards::release();
+                }
+
+                // Returns the object, NULL if there is none.
+                const T *get() const { return m_object; }
+
+                const T *operator->() const { return m_object; }
+
+            private:
+
+                Reader(const Reader &);
+                Reader &operator=(const Reader &);
+
+                std::atomic<const void*>   &m_slot;
+                const T                    *m_object;
+        };
+
+    private:
+
+        MLaProtected(const MLaProtected &);
+        MLaProtected &operator=(const MLaProtected &);
+
+        std::atomic<const T*>   m_current;
+        Pointer                 m_owner;
+
+        // Replaced objects which may still be read, and their number.
+        std::vector<Pointer>    m_retired;
+        std::atomic<size_t>     m_retiredCount;
+};
+
+#endif /* __MLA_HAZARDS_H__ */
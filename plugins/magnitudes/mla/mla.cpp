@@ -1,6 +1,8 @@
 #define SEISCOMP_COMPONENT MLa
 
 #include "mla.h"
+#include "statistics.h"
+#include "vectormath.h"
 
 #include <seiscomp/logging/log.h>
 #if SC_API_VERSION < SC_API_VERSION_CHECK(12,0,0)
@@ -9,7 +11,13 @@
 #include <seiscomp/geo/feature.h>
 #endif
 #include <seiscomp/math/geo.h>
+#include <seiscomp/core/strings.h>
+#include <seiscomp/datamodel/network.h>
+#include <seiscomp/datamodel/sensorlocation.h>
+#include <seiscomp/datamodel/station.h>
+#include <seiscomp/datamodel/amplitude.h>
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <math.h>
@@ -17,8 +25,8 @@
 
 ADD_SC_PLUGIN(
         ( "MLa magnitude. Calculates magnitude based on universal formulae "
-        "MLa=c0_log10(Amp)+c1*log10(delta*c3+c4)+c5*(delta+c6), "
-        "where coefficients c1...6 vary based on epicentral location."),
+        "MLa=c0*log10(Amp)+c1*log10(R*c3+c4)+c5*(R+c6)+c2, "
+        "where coefficients c0...6 vary based on epicentral location."),
         "Geoscience Australia", 0, 0, 2);
 
 // Register the amplitude processor.
@@ -29,21 +37,32 @@ REGISTER_AMPLITUDEPROCESSOR(Amplitude_MLA, GA_ML_AUS_AMP_TYPE);
 //  MLa AMPLITUDE PROCESSOR.
 
 Amplitude_MLA::Amplitude_MLA(const std::string& type)
-    : Seiscomp::Processing::AmplitudeProcessor_MLv()
+    : Seiscomp::Processing::AmplitudeProcessor_MLv(),
+      m_decimationRate(0), m_decimatedInputRate(0), m_decimatedLast(0),
+      m_provisionalInterval(0), m_emittingProvisional(false)
 {
+    resetProvisional();
     // Change max distance to 11 degrees.
     setMaxDist(11);
     this->_type = type;
 }
 
 Amplitude_MLA::Amplitude_MLA(const Seiscomp::Core::Time& trigger, const std::string& type)
-    : Seiscomp::Processing::AmplitudeProcessor_MLv(trigger)
+    : Seiscomp::Processing::AmplitudeProcessor_MLv(trigger),
+      m_decimationRate(0), m_decimatedInputRate(0), m_decimatedLast(0),
+      m_provisionalInterval(0), m_emittingProvisional(false)
 {
+    resetProvisional();
     // Change max distance to 11 degrees.
     setMaxDist(11);
     this->_type = type;
 }
 
+Amplitude_MLA::~Amplitude_MLA()
+{
+    MLaBufferPool::release(_data.impl());
+}
+
 int Amplitude_MLA::capabilities() const
 {
     // To get the correct calculation, we need to ensure the base MLv class
@@ -75,6 +94,318 @@ bool Amplitude_MLA::setParameter(Capability cap, const std::string &value)
     return false;
 }
 
+bool Amplitude_MLA::setup(const Seiscomp::Processing::Settings &settings)
+{
+    if (!Seiscomp::Processing::AmplitudeProcessor_MLv::setup(settings))
+    {
+        return false;
+    }
+
+    m_decimationRate = 0;
+    try{
+        m_decimationRate = settings.getDouble("amplitudes." + _type + ".decimationRate");
+    }
+    catch(...)
+    {
+    }
+    m_decimatedInputRate = 0;
+
+    m_provisionalInterval = 0;
+    try{
+        m_provisionalInterval = settings.getDouble("amplitudes." + _type + ".provisionalInterval");
+    }
+    catch(...)
+    {
+    }
+
+    double statisticsInterval = 0;
+    try{
+        statisticsInterval = settings.getDouble("mla.statisticsInterval");
+    }
+    catch(...)
+    {
+    }
+    MLaStatistics::configure(statisticsInterval);
+
+    return true;
+}
+
+void Amplitude_MLA::reset()
+{
+    Seiscomp::Processing::AmplitudeProcessor_MLv::reset();
+    resetProvisional();
+    m_decimatedInputRate = 0;
+}
+
+void Amplitude_MLA::resetProvisional()
+{
+    m_provisionalStart = Seiscomp::Core::Time();
+    m_noiseKnown = false;
+    m_offset = 0;
+    m_noise = 0;
+    m_scanned = 0;
+    m_peak = -1;
+    m_peakIndex = -1;
+    m_peakChanged = false;
+    m_provisionalEmitted = false;
+}
+
+void Amplitude_MLA::process(const Seiscomp::Record *record)
+{
+    Seiscomp::Processing::AmplitudeProcessor_MLv::process(record);
+
+    if (m_provisionalInterval > 0 && !isFinished())
+    {
+        updateProvisional(record);
+    }
+}
+
+int Amplitude_MLA::dataIndex(double secondsAfterTrigger) const
+{
+    double seconds = (double)(trigger() - dataTimeWindow().startTime()) + secondsAfterTrigger;
+    return (int)(seconds * _stream.fsamp + 0.5);
+}
+
+void Amplitude_MLA::updateProvisional(const Seiscomp::Record *record)
+{
+    const Seiscomp::DoubleArray &data = continuousData();
+
+    // The buffer starts over after a gap, and so does the search.
+    if (dataTimeWindow().startTime() != m_provisionalStart)
+    {
+        m_provisionalStart = dataTimeWindow().startTime();
+        m_noiseKnown = false;
+        m_peak = -1;
+        m_peakIndex = -1;
+        m_peakChanged = false;
+    }
+
+    // Provisional amplitudes need the offset, i.e. the complete noise
+    // window, which precedes the signal window.
+    if (!m_noiseKnown)
+    {
+        int n1 = std::max(0, dataIndex((double)_config.noiseBegin));
+        int n2 = dataIndex((double)_config.noiseEnd);
+        if (n2 > data.size() || n2 <= n1 ||
+            !computeNoise(data, n1, n2, &m_offset, &m_noise))
+        {
+            return;
+        }
+
+        m_noiseKnown = true;
+        m_scanned = std::max(0, dataIndex((double)_config.signalBegin));
+    }
+
+    const int si1 = std::max(0, dataIndex((double)_config.signalBegin));
+    const int si2 = std::min(data.size(), dataIndex((double)_config.signalEnd));
+    // The kernel would report a NaN first sample as the peak of the chunk.
+    const double *samples = data.typedData();
+    while (m_scanned < si2 && isnan(samples[m_scanned] - m_offset))
+    {
+        m_scanned++;
+    }
+
+    if (m_scanned < si2)
+    {
+        int i = (int)MLaAbsMaxIndex(samples, m_scanned, si2, m_offset);
+        double deviation = fabs(samples[i] - m_offset);
+        if (deviation > m_peak)
+        {
+            m_peak = deviation;
+            m_peakIndex = i;
+            m_peakChanged = true;
+        }
+        m_scanned = si2;
+    }
+
+    const Seiscomp::Core::Time dataEnd = dataTimeWindow().endTime();
+    if (!m_peakChanged || (m_provisionalEmitted &&
+        (double)(dataEnd - m_lastProvisional) < m_provisionalInterval))
+    {
+        return;
+    }
+
+    // Let MLv evaluate the peak alone, so that the provisional values follow
+    // the same conventions as the final one.
+    AmplitudeIndex dt;
+    AmplitudeValue amplitude;
+    double period, snr;
+    _noiseAmplitude = m_noise;
+    if (!Seiscomp::Processing::AmplitudeProcessor_MLv::computeAmplitude(
+            data, si1, si2, m_peakIndex, m_peakIndex + 1, m_offset,
+            &dt, &amplitude, &period, &snr) || snr < _config.snrMin)
+    {
+        return;
+    }
+
+    Result res;
+    res.record = record;
+    res.amplitude = amplitude;
+    res.amplitude.value *= 0.5;
+    res.time.reference =
+        dataTimeWindow().startTime() + Seiscomp::Core::TimeSpan(dt.index / _stream.fsamp);
+    res.time.begin = dt.begin / _stream.fsamp;
+    res.time.end = dt.end / _stream.fsamp;
+    res.period = period > 0 ? period / _stream.fsamp : period;
+    res.snr = snr;
+
+    m_peakChanged = false;
+    m_provisionalEmitted = true;
+    m_lastProvisional = dataEnd;
+    m_emittingProvisional = true;
+    emitAmplitude(res);
+    m_emittingProvisional = false;
+}
+
+void Amplitude_MLA::finalizeAmplitude(Seiscomp::DataModel::Amplitude *amplitude) const
+{
+    Seiscomp::Processing::AmplitudeProcessor_MLv::finalizeAmplitude(amplitude);
+
+    const Seiscomp::DataModel::CommentIndex index(GA_ML_AUS_PROVISIONAL_COMMENT);
+    if (!m_emittingProvisional)
+    {
+        // The amplitude object may be the one of a provisional amplitude,
+        // updated with the final value.
+        amplitude->removeComment(index);
+        return;
+    }
+
+    if (amplitude->comment(index) == NULL)
+    {
+        Seiscomp::DataModel::CommentPtr comment = new Seiscomp::DataModel::Comment;
+        comment->setId(GA_ML_AUS_PROVISIONAL_COMMENT);
+        comment->setText("Provisional amplitude, the signal window is incomplete");
+        amplitude->add(comment.get());
+    }
+}
+
+bool Amplitude_MLA::feed(const Seiscomp::Record *record)
+{
+    if (m_decimationRate > 0)
+    {
+        return feedDecimated(record);
+    }
+
+    return feedBuffered(record);
+}
+
+bool Amplitude_MLA::feedBuffered(const Seiscomp::Record *record)
+{
+    // MLv keeps the buffer, with its capacity, across gaps and resets, so
+    // this usually happens once per processor.
+    Seiscomp::DoubleArray::DataArray &samples = _data.impl();
+    if (samples.empty())
+    {
+        double length = (double)safetyTimeWindow().length();
+        size_t needed = length > 0 ? (size_t)ceil(length * record->samplingFrequency()) + 1 : 0;
+        if (samples.capacity() < needed)
+        {
+            MLaBufferPool::release(samples);
+            MLaBufferPool::acquire(needed, samples);
+        }
+    }
+
+    return Seiscomp::Processing::AmplitudeProcessor_MLv::feed(record);
+}
+
+bool Amplitude_MLA::feedDecimated(const Seiscomp::Record *record)
+{
+    // The filter starts over for a new rate and after gaps and overlaps,
+    // which MLv then handles as usual.
+    const double samplingFrequency = record->samplingFrequency();
+    if (samplingFrequency != m_decimatedInputRate)
+    {
+        m_decimatedInputRate = samplingFrequency;
+        m_decimator.configure(samplingFrequency, m_decimationRate);
+    }
+    else if (fabs((double)(record->startTime() - m_decimatedNext)) > 0.5 / samplingFrequency)
+    {
+        m_decimator.reset();
+    }
+
+    if (m_decimator.factor() < 2)
+    {
+        return feedBuffered(record);
+    }
+
+    const Seiscomp::Array *data = record->data();
+    if (data == NULL)
+    {
+        return false;
+    }
+
+    // Records usually come with integer samples, those and single precision
+    // ones are converted without allocating.
+    const double *samples;
+    size_t count;
+    Seiscomp::DoubleArrayPtr converted;
+    if (const Seiscomp::DoubleArray *doubles = Seiscomp::DoubleArray::ConstCast(data))
+    {
+        samples = doubles->typedData();
+        count = doubles->size();
+    }
+    else if (const Seiscomp::IntArray *ints = Seiscomp::IntArray::ConstCast(data))
+    {
+        m_decimatedInput.assign(ints->typedData(), ints->typedData() + ints->size());
+        samples = m_decimatedInput.data();
+        count = m_decimatedInput.size();
+    }
+    else if (const Seiscomp::FloatArray *floats = Seiscomp::FloatArray::ConstCast(data))
+    {
+        m_decimatedInput.assign(floats->typedData(), floats->typedData() + floats->size());
+        samples = m_decimatedInput.data();
+        count = m_decimatedInput.size();
+    }
+    else
+    {
+        converted = static_cast<Seiscomp::DoubleArray*>(data->copy(Seiscomp::Array::DOUBLE));
+        samples = converted->typedData();
+        count = converted->size();
+    }
+
+    Seiscomp::GenericRecord *decimated = decimatedRecord(record);
+    Seiscomp::DoubleArray *output = static_cast<Seiscomp::DoubleArray*>(decimated->data());
+
+    m_decimatedNext = record->endTime();
+    long first = m_decimator.process(samples, count, output->impl());
+    if (output->impl().empty())
+    {
+        // Still filling the filter.
+        return true;
+    }
+
+    decimated->setStartTime(record->startTime() + Seiscomp::Core::TimeSpan(first / samplingFrequency));
+    decimated->setSamplingFrequency(m_decimator.outputRate());
+    decimated->setTimingQuality(record->timingQuality());
+    decimated->dataUpdated();
+
+    return feedBuffered(decimated);
+}
+
+Seiscomp::GenericRecord *Amplitude_MLA::decimatedRecord(const Seiscomp::Record *record)
+{
+    for (size_t i = 0; i < 2; i++)
+    {
+        const Seiscomp::GenericRecordPtr &decimated = m_decimatedRecords[i];
+        if (decimated && decimated->referenceCount() == 1)
+        {
+            m_decimatedLast = i;
+            return decimated.get();
+        }
+    }
+
+    // Replaces the record not fed last, e.g. after it was taken over by a
+    // callback, or creates the first ones.
+    m_decimatedLast = 1 - m_decimatedLast;
+    Seiscomp::GenericRecordPtr &decimated = m_decimatedRecords[m_decimatedLast];
+    decimated = new Seiscomp::GenericRecord(
+        record->networkCode(), record->stationCode(),
+        record->locationCode(), record->channelCode(),
+        record->startTime(), m_decimator.outputRate(), record->timingQuality());
+    decimated->setData(new Seiscomp::DoubleArray);
+    return decimated.get();
+}
+
 bool Amplitude_MLA::computeAmplitude(const Seiscomp::DoubleArray &data,
         size_t i1, size_t i2,
         size_t si1, size_t si2,
@@ -82,6 +413,16 @@ bool Amplitude_MLA::computeAmplitude(const Seiscomp::DoubleArray &data,
         AmplitudeIndex *dt, AmplitudeValue *amplitude,
         double *period, double *snr)
 {
+    MLaStopwatch stopwatch;
+
+    // Find the peak with the vector kernel and let MLv evaluate just that
+    // sample, which gives the same index and value as its own search.
+    if (si1 < si2)
+    {
+        si1 = MLaAbsMaxIndex(data.typedData(), si1, si2, offset);
+        si2 = si1 + 1;
+    }
+
     bool retVal = Seiscomp::Processing::AmplitudeProcessor_MLv::computeAmplitude(
         data,
         i1, i2,
@@ -96,7 +437,12 @@ bool Amplitude_MLA::computeAmplitude(const Seiscomp::DoubleArray &data,
     {
         amplitude->value *= 0.5;
     }
+    else if (MLaStatistics::enabled())
+    {
+        MLaStatistics::amplitudeFailures.fetch_add(1, std::memory_order_relaxed);
+    }
 
+    stopwatch.stop(MLaStatistics::amplitudes);
     return retVal;
 }
 
@@ -110,25 +456,182 @@ bool Amplitude_MLA::computeAmplitude(const Seiscomp::DoubleArray &data,
 // Register the magnitude processor.
 REGISTER_MAGNITUDEPROCESSOR(Magnitude_MLA, GA_ML_AUS_MAG_TYPE);
 
+namespace {
+
+/*
+A memoized region resolution. The region an epicentre falls within only
+depends on the region set (by its serial, 0 for unused entries) and the
+epicentre, so all processors using the same region set share the entries,
+whatever zones they map the regions to.
+*/
+struct RegionCacheEntry
+{
+    uint64_t    serial;
+    double      lat;
+    double      lon;
+    // -1 if the epicentre is not within any region.
+    int         region;
+};
+
+// Number of epicentres memoized. scmag works on a handful of origins at a
+// time, typically updates of the same event.
+const size_t RegionCacheSize = 8;
+
+// Region resolutions of recent epicentres, per thread so that computations
+// in several threads do not share any state, replaced round robin. All
+// station magnitudes of an origin share one resolution, whichever of the
+// per station processors computes them.
+thread_local RegionCacheEntry regionCache[RegionCacheSize];
+thread_local size_t regionCacheNext;
+
+/*
+Returns the built-in coefficients of a zone.
+
+@param zone: The zone (bna region) name.
+@param coefficients: The built-in coefficients.
+@returns false if there are no built-in coefficients for the zone.
+*/
+bool builtinCoefficients(const std::string &zone, MLaCoefficients &coefficients)
+{
+    if (zone == "West")
+    {
+        coefficients = MLaWestCoefficients;
+    }
+    else if (zone == "East")
+    {
+        coefficients = MLaEastCoefficients;
+    }
+    else if (zone == "South")
+    {
+        coefficients = MLaSouthCoefficients;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+}
+
 Magnitude_MLA::Magnitude_MLA()
-    : Seiscomp::Processing::MagnitudeProcessor(GA_ML_AUS_MAG_TYPE)
+    : Seiscomp::Processing::MagnitudeProcessor(GA_ML_AUS_MAG_TYPE),
+      m_regionsGeneration(0), m_correctionsGeneration(0),
+      m_hasBindingCorrection(false), m_bindingCorrection(0),
+      m_useAttenuationTables(false)
 {
-    m_regions = new Seiscomp::Geo::GeoFeatureSet();
-    m_fileCat = new Seiscomp::Geo::Category(1);
-    setupRegionToCalc();
 }
 
 Magnitude_MLA::~Magnitude_MLA()
 {
-    delete m_regions;
-    delete m_fileCat;
 }
 
-void Magnitude_MLA::setupRegionToCalc()
+bool Magnitude_MLA::setupZones(const Seiscomp::Processing::Settings &settings)
 {
-    m_regionToCalcMap[std::string("West")] = &Magnitude_MLA::computeMagWest;
-    m_regionToCalcMap[std::string("East")] = &Magnitude_MLA::computeMagEast;
-    m_regionToCalcMap[std::string("South")] = &Magnitude_MLA::computeMagSouth;
+    std::vector<std::string> names;
+    try{
+        Seiscomp::Core::split(names, settings.getString("mla.zones").c_str(), ",");
+    }
+    catch(...)
+    {
+        names.push_back("West");
+        names.push_back("East");
+        names.push_back("South");
+    }
+
+    m_useAttenuationTables = false;
+    try{
+        m_useAttenuationTables = settings.getBool("mla.attenuationTable");
+    }
+    catch(...)
+    {
+    }
+
+    m_zoneNames.clear();
+    m_zoneSlots.clear();
+    m_zones.clear();
+    m_attenuations.clear();
+
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        std::string name = names[i];
+        Seiscomp::Core::trim(name);
+        if (name.empty() ||
+            std::find(m_zoneNames.begin(), m_zoneNames.end(), name) != m_zoneNames.end())
+        {
+            continue;
+        }
+
+        MLaCoefficients coefficients;
+        std::string parameter = "mla.zone." + name + ".coefficients";
+        std::string values;
+        try{
+            values = settings.getString(parameter);
+        }
+        catch(...)
+        {
+            if (!builtinCoefficients(name, coefficients))
+            {
+                SEISCOMP_ERROR(
+                    "%s zone %s has no built-in coefficients, %s is required",
+                    GA_ML_AUS_MAG_TYPE, name.c_str(), parameter.c_str()
+                );
+                return false;
+            }
+        }
+
+        if (!values.empty())
+        {
+            std::vector<std::string> tokens;
+            Seiscomp::Core::split(tokens, values.c_str(), ",");
+            double c[7];
+            bool valid = tokens.size() == 7;
+            for (size_t k = 0; valid && k < tokens.size(); k++)
+            {
+                Seiscomp::Core::trim(tokens[k]);
+                valid = Seiscomp::Core::fromString(c[k], tokens[k]);
+            }
+
+            if (!valid)
+            {
+                SEISCOMP_ERROR(
+                    "%s: %s must be a list of the 7 coefficients c0, ..., c6",
+                    GA_ML_AUS_MAG_TYPE, parameter.c_str()
+                );
+                return false;
+            }
+
+            MLaCoefficients configured = { c[0], c[1], c[2], c[3], c[4], c[5], c[6] };
+            coefficients = configured;
+        }
+
+        m_zoneNames.push_back(name);
+        m_zoneSlots.push_back(MLaStatistics::zone(name));
+        m_zones.push_back(coefficients);
+
+        m_attenuations.push_back(MLaAttenuationTable());
+        if (m_useAttenuationTables)
+        {
+            double error = m_attenuations.back().build(coefficients);
+            if (!m_attenuations.back().valid())
+            {
+                SEISCOMP_WARNING(
+                    "%s zone %s: attenuation table error %g exceeds %g, using the exact formula",
+                    GA_ML_AUS_MAG_TYPE, name.c_str(), error, MLaAttenuationMaxError
+                );
+            }
+            else
+            {
+                SEISCOMP_DEBUG(
+                    "%s zone %s: attenuation table error %g",
+                    GA_ML_AUS_MAG_TYPE, name.c_str(), error
+                );
+            }
+        }
+    }
+
+    return true;
 }
 
 bool Magnitude_MLA::setup(const Seiscomp::Processing::Settings &settings)
@@ -146,15 +649,254 @@ bool Magnitude_MLA::setup(const Seiscomp::Processing::Settings &settings)
         return false;
     }
 
-    if (!m_regions->readBNAFile(filePath, m_fileCat))
+    if (!setupZones(settings))
+    {
+        return false;
+    }
+
+    double statisticsInterval = 0;
+    try{
+        statisticsInterval = settings.getDouble("mla.statisticsInterval");
+    }
+    catch(...)
+    {
+    }
+    MLaStatistics::configure(statisticsInterval);
+
+    double reloadInterval = 0;
+    try{
+        reloadInterval = settings.getDouble("mla.reloadInterval");
+    }
+    catch(...)
+    {
+    }
+
+    MLaRasterSpec raster;
+    if (!setupRaster(settings, raster))
+    {
+        return false;
+    }
+
+    MLaRegionSetPtr regions;
+    if (reloadInterval > 0)
+    {
+        m_watch = MLaRegionStore::watch(filePath, reloadInterval, raster);
+        if (!m_watch)
+        {
+            return false;
+        }
+        m_regionsGeneration.store(m_watch->generation(), std::memory_order_relaxed);
+        regions = m_watch->current();
+    }
+    else
+    {
+        m_watch.reset();
+        regions = MLaRegionStore::acquire(filePath, raster);
+        if (!regions)
+        {
+            return false;
+        }
+    }
+
+    if (!setupCorrections(settings, reloadInterval))
     {
-        SEISCOMP_ERROR("Can not read the bna region file at %s", filePath.c_str());
         return false;
     }
 
+    useRegions(regions);
+    return true;
+}
+
+bool Magnitude_MLA::setupRaster(const Seiscomp::Processing::Settings &settings,
+                                MLaRasterSpec &raster)
+{
+    try{
+        raster.resolution = settings.getDouble("mla.rasterResolution");
+    }
+    catch(...)
+    {
+    }
+
+    std::string box;
+    try{
+        box = settings.getString("mla.rasterBox");
+    }
+    catch(...)
+    {
+    }
+
+    if (!box.empty())
+    {
+        std::vector<std::string> tokens;
+        Seiscomp::Core::split(tokens, box.c_str(), ",");
+        double bounds[4];
+        bool valid = tokens.size() == 4;
+        for (size_t k = 0; valid && k < tokens.size(); k++)
+        {
+            Seiscomp::Core::trim(tokens[k]);
+            valid = Seiscomp::Core::fromString(bounds[k], tokens[k]);
+        }
+        if (!valid)
+        {
+            SEISCOMP_ERROR(
+                "%s mla.rasterBox needs 4 values: latMin, latMax, lonMin, lonMax",
+                GA_ML_AUS_MAG_TYPE
+            );
+            return false;
+        }
+        raster.latMin = bounds[0];
+        raster.latMax = bounds[1];
+        raster.lonMin = bounds[2];
+        raster.lonMax = bounds[3];
+    }
+
+    return true;
+}
+
+bool Magnitude_MLA::setupCorrections(const Seiscomp::Processing::Settings &settings,
+                                     double reloadInterval)
+{
+    m_hasBindingCorrection = false;
+    try{
+        m_bindingCorrection = settings.getDouble("mla.stationCorrection");
+        m_hasBindingCorrection = true;
+    }
+    catch(...)
+    {
+    }
+    m_bindingNetwork = settings.networkCode;
+    m_bindingStation = settings.stationCode;
+
+    std::string filePath;
+    try{
+        filePath = settings.getString("mla.stationCorrectionFile");
+    }
+    catch(...)
+    {
+    }
+
+    m_correctionWatch.reset();
+    m_corrections.replace(MLaStationCorrectionsPtr());
+    if (filePath.empty())
+    {
+        return true;
+    }
+
+    if (reloadInterval > 0)
+    {
+        m_correctionWatch = MLaStationCorrectionStore::watch(filePath, reloadInterval);
+        if (!m_correctionWatch)
+        {
+            return false;
+        }
+        m_correctionsGeneration.store(m_correctionWatch->generation(), std::memory_order_relaxed);
+        m_corrections.replace(m_correctionWatch->current());
+    }
+    else
+    {
+        MLaStationCorrectionsPtr corrections = MLaStationCorrectionStore::acquire(filePath);
+        if (!corrections)
+        {
+            return false;
+        }
+        m_corrections.replace(corrections);
+    }
+
     return true;
 }
 
+double Magnitude_MLA::stationCorrection(const std::string &network,
+                                        const std::string &station,
+                                        const std::string &location) const
+{
+    // Bindings are per station, the correction applies to all of its
+    // locations.
+    if (m_hasBindingCorrection && station == m_bindingStation &&
+        network == m_bindingNetwork)
+    {
+        return m_bindingCorrection;
+    }
+
+    refresh();
+    MLaProtected<MLaStationCorrections>::Reader corrections(m_corrections);
+    double correction;
+    if (corrections.get() && corrections->find(network, station, location, correction))
+    {
+        return correction;
+    }
+    return 0;
+}
+
+void Magnitude_MLA::useRegions(const MLaRegionSetPtr &regions) const
+{
+    // Tie every region of the file to its zone once, so that computing a
+    // magnitude does not need to look at region names.
+    std::shared_ptr<RegionState> state(new RegionState);
+    state->regions = regions;
+    state->featureZones.assign(regions->size(), -1);
+    for (size_t i = 0; i < regions->size(); i++)
+    {
+        std::vector<std::string>::const_iterator it =
+            std::find(m_zoneNames.begin(), m_zoneNames.end(), regions->name(i));
+        if (it == m_zoneNames.end())
+        {
+            SEISCOMP_WARNING(
+                "%s region %s in %s has no zone configured, origins within it are ignored",
+                GA_ML_AUS_MAG_TYPE, regions->name(i).c_str(), regions->path().c_str()
+            );
+            continue;
+        }
+        state->featureZones[i] = it - m_zoneNames.begin();
+    }
+
+    // Resolutions against the previous regions are stale now, the serial of
+    // the new region set keeps the region caches from returning them.
+    m_regions.replace(state);
+}
+
+void Magnitude_MLA::refresh() const
+{
+    const bool regions = m_watch &&
+        m_watch->generation() != m_regionsGeneration.load(std::memory_order_acquire);
+    const bool corrections = m_correctionWatch &&
+        m_correctionWatch->generation() != m_correctionsGeneration.load(std::memory_order_acquire);
+    if (!regions && !corrections && !m_regions.retired() && !m_corrections.retired())
+    {
+        return;
+    }
+
+    // One thread switches, the others go on with the previous versions
+    // meanwhile.
+    std::unique_lock<std::mutex> lock(m_reloadMutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        return;
+    }
+
+    if (m_watch)
+    {
+        unsigned generation = m_watch->generation();
+        if (generation != m_regionsGeneration.load(std::memory_order_relaxed))
+        {
+            useRegions(m_watch->current());
+            m_regionsGeneration.store(generation, std::memory_order_release);
+        }
+    }
+    if (m_correctionWatch)
+    {
+        unsigned generation = m_correctionWatch->generation();
+        if (generation != m_correctionsGeneration.load(std::memory_order_relaxed))
+        {
+            m_corrections.replace(m_correctionWatch->current());
+            m_correctionsGeneration.store(generation, std::memory_order_release);
+        }
+    }
+
+    // Versions still read by other threads when they were replaced.
+    m_regions.reclaim();
+    m_corrections.reclaim();
+}
+
 std::string Magnitude_MLA::amplitudeType() const
 {
     return GA_ML_AUS_AMP_TYPE;
@@ -178,90 +920,173 @@ Seiscomp::Processing::MagnitudeProcessor::Status Magnitude_MLA::computeMagnitude
 #endif
       double &value)
 {
-    // The calculation used will depend on which of these regions the origin
-    // falls within. Retrieve the longitude and latitude of the origin.
-    Seiscomp::Geo::Vertex originLoc;
-    originLoc.lon = hypocenter->longitude().value();
-    originLoc.lat = hypocenter->latitude().value();
-    const std::vector<Seiscomp::Geo::GeoFeature*> regions = m_regions->features();
-    for(unsigned int i = 0; i < regions.size(); i++)
+    // The coefficients used will depend on which of these regions the origin
+    // falls within.
+    MLaStopwatch resolution;
+    int zone = resolveZone(hypocenter);
+    resolution.stop(MLaStatistics::regionResolutions);
+
+    if (zone >= 0)
     {
-        if (regions[i]->contains(originLoc))
+        MLaStopwatch evaluation;
+        value = zoneMagnitude(zone, amplitudeValue, delta, depth);
+
+        const Seiscomp::DataModel::Station *station = receiver ? receiver->station() : NULL;
+        if (station && station->network())
+        {
+            value += stationCorrection(station->network()->code(), station->code(), receiver->code());
+        }
+#if SC_API_VERSION >= SC_API_VERSION_CHECK(12,0,0)
+        else if (amplitude)
         {
-            MagCalc calcFunction = m_regionToCalcMap[regions[i]->name()];
-            return (this->*calcFunction)(amplitudeValue, period, delta, depth, value);
+            const Seiscomp::DataModel::WaveformStreamID &waveformID = amplitude->waveformID();
+            value += stationCorrection(waveformID.networkCode(), waveformID.stationCode(),
+                                       waveformID.locationCode());
         }
+#endif
+        else if (m_hasBindingCorrection)
+        {
+            value += m_bindingCorrection;
+        }
+
+        if (m_zoneSlots[zone] >= 0)
+        {
+            evaluation.stop(MLaStatistics::zoneFormulas[m_zoneSlots[zone]]);
+        }
+        return OK;
     }
 
     // When the information is not within the regions, return a could not
     // calculate status.
+    if (MLaStatistics::enabled())
+    {
+        MLaStatistics::outOfRegion.fetch_add(1, std::memory_order_relaxed);
+    }
     return DistanceOutOfRange;
 }
 
-double Magnitude_MLA::distance(double delta, double depth)
+double Magnitude_MLA::zoneMagnitude(int zone, double amplitude, double delta, double depth) const
 {
-    double deltaKms = Seiscomp::Math::Geo::deg2km(delta);
-    return sqrt(pow(depth, 2) + pow(deltaKms, 2));
+    const MLaCoefficients &coefficients = m_zones[zone];
+    const MLaAttenuationTable &attenuation = m_attenuations[zone];
+    if (attenuation.valid())
+    {
+        return (
+                coefficients.c0 * log10(amplitude) +
+                attenuation.evaluate(squaredDistance(delta, depth)) +
+                coefficients.c2);
+    }
+    return formula(coefficients, amplitude, distance(delta, depth));
 }
 
-// Calculates the ml magnitude for the west region (Western Australia).
-// @param amplitude: Amplitude of the seismic event (in millimetres).
-// @param period: (in seconds).
-// @param delta: (in degrees).
-// @param depth: the depth of the epicentre of the event (in kms).
-// @param value: The result of the calculation.
-Seiscomp::Processing::MagnitudeProcessor::Status Magnitude_MLA::computeMagWest(
-      double amplitude,   // in millimetres
-      double period,      // in seconds
-      double delta,       // in degrees
-      double depth,       // in kilometres
-      double &value)
+Seiscomp::Processing::MagnitudeProcessor::Status Magnitude_MLA::computeMagnitudes(
+      const Seiscomp::DataModel::Origin *hypocenter,
+      size_t count,
+      const double *amplitudes, // in millimetres
+      const double *deltas,     // in degrees
+      const double *depths,     // in kilometres
+      double *values)
 {
-    double r = Magnitude_MLA::distance(delta, depth);
-    value = (
-            log10(amplitude) + (1.137 * log10(r)) +
-            (0.000657 * r) + 0.66);
+    MLaStopwatch resolution;
+    int zone = resolveZone(hypocenter);
+    resolution.stop(MLaStatistics::regionResolutions);
+
+    if (zone < 0)
+    {
+        if (MLaStatistics::enabled())
+        {
+            MLaStatistics::outOfRegion.fetch_add(count, std::memory_order_relaxed);
+        }
+        return DistanceOutOfRange;
+    }
+
+    MLaEvaluateBatch(m_zones[zone], count, amplitudes, deltas, depths, values);
+    if (MLaStatistics::enabled() && m_zoneSlots[zone] >= 0)
+    {
+        MLaStatistics::zoneBatched[m_zoneSlots[zone]].fetch_add(count, std::memory_order_relaxed);
+    }
     return OK;
 }
 
-// Calculates the ml magnitude for the east region (Eastern Australia).
-// @param amplitude: Amplitude of the seismic event (in millimetres).
-// @param period: (in seconds).
-// @param delta: (in degrees).
-// @param depth: the depth of the epicentre of the event (in kms).
-// @param value: The result of the calculation.
-Seiscomp::Processing::MagnitudeProcessor::Status Magnitude_MLA::computeMagEast(
-      double amplitude,   // in millimetres
-      double period,      // in seconds
-      double delta,       // in degrees
-      double depth,       // in kilometres
-      double &value)
+int Magnitude_MLA::resolveZone(const Seiscomp::DataModel::Origin *hypocenter) const
 {
-    double r = Magnitude_MLA::distance(delta, depth);
-    value = (
-            log10(amplitude) + (1.34 * log10(r / 100)) +
-            (0.00055 * (r - 100)) + 3.13);
-    return OK;
+    // Switch to reloaded regions between two computations. Previous region
+    // sets no thread reads anymore are released here.
+    refresh();
+    MLaProtected<RegionState>::Reader state(m_regions);
+    if (state.get() == NULL)
+    {
+        // No regions, e.g. the processor has not been set up.
+        return -1;
+    }
+
+    const double lat = hypocenter->latitude().value();
+    const double lon = hypocenter->longitude().value();
+
+    const uint64_t serial = state->regions->serial();
+    for (size_t i = 0; i < RegionCacheSize; i++)
+    {
+        const RegionCacheEntry &entry = regionCache[i];
+        if (entry.serial == serial && entry.lat == lat && entry.lon == lon)
+        {
+            if (MLaStatistics::enabled())
+            {
+                MLaStatistics::regionCacheHits.fetch_add(1, std::memory_order_relaxed);
+            }
+            return entry.region >= 0 ? state->featureZones[entry.region] : -1;
+        }
+    }
+
+    if (MLaStatistics::enabled())
+    {
+        MLaStatistics::regionCacheMisses.fetch_add(1, std::memory_order_relaxed);
+    }
+    Seiscomp::Geo::Vertex location;
+    location.lon = lon;
+    location.lat = lat;
+    int region = state->regions->find(location);
+
+    RegionCacheEntry &entry = regionCache[regionCacheNext];
+    regionCacheNext = (regionCacheNext + 1) % RegionCacheSize;
+    entry.serial = serial;
+    entry.lat = lat;
+    entry.lon = lon;
+    entry.region = region;
+
+    return region >= 0 ? state->featureZones[region] : -1;
 }
 
-// Calculates the ml magnitude for the south region (Flinders Ranges).
-// @param amplitude: Amplitude of the seismic event (in millimetres).
-// @param period: (in seconds).
-// @param delta: (in degrees).
-// @param depth: the depth of the epicentre of the event (in kms).
-// @param value: The result of the calculation.
-Seiscomp::Processing::MagnitudeProcessor::Status Magnitude_MLA::computeMagSouth(
-      double amplitude,   // in millimetres
-      double period,      // in seconds
-      double delta,       // in degrees
-      double depth,       // in kilometres
-      double &value)
+int Magnitude_MLA::zone(double latitude, double longitude) const
 {
-    double r = Magnitude_MLA::distance(delta, depth);
-    value = (
-            log10(amplitude) + (1.1 * log10(r)) +
-            (0.0013 * r) + 0.7);
-    return OK;
+    refresh();
+    MLaProtected<RegionState>::Reader state(m_regions);
+    if (state.get() == NULL)
+    {
+        return -1;
+    }
+    return findZone(*state.get(), latitude, longitude);
+}
+
+int Magnitude_MLA::findZone(const RegionState &state, double latitude, double longitude)
+{
+    Seiscomp::Geo::Vertex location;
+    location.lon = longitude;
+    location.lat = latitude;
+
+    int regionIdx = state.regions->find(location);
+    return regionIdx >= 0 ? state.featureZones[regionIdx] : -1;
+}
+
+double Magnitude_MLA::distance(double delta, double depth)
+{
+    double deltaKms = Seiscomp::Math::Geo::deg2km(delta);
+    return sqrt(pow(depth, 2) + pow(deltaKms, 2));
+}
+
+double Magnitude_MLA::squaredDistance(double delta, double depth)
+{
+    double deltaKms = Seiscomp::Math::Geo::deg2km(delta);
+    return depth * depth + deltaKms * deltaKms;
 }
 
 // END MLa MAGNITUDE PROCESSOR
@@ -8,8 +8,12 @@
 #define GA_ML_AUS_AMP_TYPE "MLa"
 #define GA_ML_AUS_MAG_TYPE "MLa"
 
+// ID of the comment marking provisional MLa amplitudes.
+#define GA_ML_AUS_PROVISIONAL_COMMENT "provisional"
+
 #include <seiscomp/processing/amplitudes/MLv.h>
 #include <seiscomp/processing/magnitudeprocessor.h>
+#include <seiscomp/core/genericrecord.h>
 #include <seiscomp/core/plugin.h>
 #if SC_API_VERSION < SC_API_VERSION_CHECK(12,0,0)
 #include <seiscomp/geo/geofeatureset.h>
@@ -17,8 +21,21 @@
 #include <seiscomp/geo/featureset.h>
 #endif
 
+#include "attenuation.h"
+#include "bufferpool.h"
+#include "coefficients.h"
+#include "decimator.h"
+#include "hazards.h"
+#include "regionstore.h"
+#include "stationcorrections.h"
+#include "statistics.h"
+
+#include <atomic>
+#include <mutex>
 #include <string>
-#include <map>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
 
 /*
 Calculates the MLa amplitude. This amplitude value is used by the MLa magnitude
@@ -44,6 +61,9 @@ public:
     */
     Amplitude_MLA(const Seiscomp::Core::Time& trigger, const std::string& type=GA_ML_AUS_AMP_TYPE);
 
+    // Destructor. Returns the continuous data buffer to MLaBufferPool.
+    virtual ~Amplitude_MLA();
+
     /*
     Returns the capabilities of the processor. This will be NoCapability.
     @returns: Capability of processor (NoCapability).
@@ -66,8 +86,59 @@ public:
     */
     virtual bool setParameter(Capability cap, const std::string &value);
 
+    /*
+    Configures the processor. Extends the base class behaviour by reading
+    amplitudes.MLa.decimationRate (see feed()),
+    amplitudes.MLa.provisionalInterval (see process()) and
+    mla.statisticsInterval (see MLaStatistics).
+    @param settings: The processor settings.
+    @returns: Whether the processor has been configured.
+    */
+    virtual bool setup(const Seiscomp::Processing::Settings &settings);
+
+    /*
+    Feeds a record. The record is processed as by MLv, after decimation to
+    amplitudes.MLa.decimationRate if that is set and the stream is sampled
+    at least twice as fast: the Wood-Anderson simulation, buffering and the
+    amplitude search then run at the lower rate (see MLaDecimator).
+    @param record: The record.
+    @returns: Whether the record has been accepted.
+    */
+    virtual bool feed(const Seiscomp::Record *record);
+
+    /*
+    Resets the processor. Extends the base class behaviour by discarding
+    the provisional amplitude state.
+    */
+    virtual void reset();
+
+    /*
+    Finalizes the amplitude object created from the result emitted last.
+    Extends the base class behaviour by adding a comment with the ID
+    GA_ML_AUS_PROVISIONAL_COMMENT to provisional amplitudes and removing it
+    from the final one, so that consumers can tell them apart.
+    @param amplitude: The amplitude object.
+    */
+    virtual void finalizeAmplitude(Seiscomp::DataModel::Amplitude *amplitude) const;
+
+    /*
+    Returns whether the result being emitted is a provisional amplitude,
+    for result callbacks which do not create amplitude objects.
+    */
+    bool isProvisional() const { return m_emittingProvisional; }
+
 protected:
 
+    /*
+    Processes the data fed so far. Extends the base class behaviour by
+    emitting provisional amplitudes while the signal window is still
+    incomplete, if amplitudes.MLa.provisionalInterval is set. The
+    provisional peak is tracked incrementally, every sample is looked at
+    once. The final amplitude is the one of the base class.
+    @param record: The record fed last.
+    */
+    virtual void process(const Seiscomp::Record *record);
+
     /*
     Computes the amplitude of data in the range[i1, i2].
     Input parameters:
@@ -98,26 +169,115 @@ protected:
             double offset,
             AmplitudeIndex *dt, AmplitudeValue *amplitude,
             double *period, double *snr);
+
+private:
+
+    /*
+    Decimates a record and feeds the result as MLv would feed the record.
+    Integer and single precision samples are converted into a buffer kept
+    by the processor, other types are copied into a new array.
+    @param record: The record.
+    @returns Whether the record has been accepted.
+    */
+    bool feedDecimated(const Seiscomp::Record *record);
+
+    /*
+    Returns a record of m_decimatedRecords to feed decimated samples in,
+    or a new one if both are still referred to.
+    @param record: The record which is decimated.
+    */
+    Seiscomp::GenericRecord *decimatedRecord(const Seiscomp::Record *record);
+
+    /*
+    Feeds a record to MLv, with the continuous data buffer taken from
+    MLaBufferPool first if it is empty and too small for the safety time
+    window.
+    @param record: The record, at the rate the data is processed at.
+    @returns Whether the record has been accepted.
+    */
+    bool feedBuffered(const Seiscomp::Record *record);
+
+    /*
+    Extends the provisional peak by the samples received since the last
+    call and emits it if it grew and the interval has passed.
+    @param record: The record fed last.
+    */
+    void updateProvisional(const Seiscomp::Record *record);
+
+    // Discards the provisional amplitude state.
+    void resetProvisional();
+
+    // Returns the data index of a time given relative to the trigger.
+    int dataIndex(double secondsAfterTrigger) const;
+
+    // Lowest acceptable sampling rate of the processed data (in Hz), 0 to
+    // process the data at the rate it comes at.
+    double      m_decimationRate;
+
+    // Decimator of the stream, configured for m_decimatedInputRate, the
+    // time the next record continuing the stream starts at and the samples
+    // of the last record which were not doubles, converted.
+    MLaDecimator         m_decimator;
+    double               m_decimatedInputRate;
+    Seiscomp::Core::Time m_decimatedNext;
+    std::vector<double>  m_decimatedInput;
+
+    // The records decimated data is fed in, reused once nothing else refers
+    // to them anymore. MLv keeps the record fed last, so they take turns,
+    // and m_decimatedLast is the one fed last.
+    Seiscomp::GenericRecordPtr m_decimatedRecords[2];
+    size_t               m_decimatedLast;
+
+    /*
+    Minimum time between provisional amplitudes (in seconds of data), 0 to
+    emit the final amplitude only.
+    */
+    double      m_provisionalInterval;
+
+    // Start of the data the provisional state refers to.
+    Seiscomp::Core::Time m_provisionalStart;
+
+    // Whether the noise window has been evaluated.
+    bool        m_noiseKnown;
+    double      m_offset;
+    double      m_noise;
+
+    // Data index up to which the signal window has been searched.
+    int         m_scanned;
+
+    // Largest absolute deviation from the offset so far, and its index.
+    double      m_peak;
+    int         m_peakIndex;
+
+    // Whether the peak changed since the last provisional amplitude.
+    bool        m_peakChanged;
+
+    // Whether and at which data end time a provisional amplitude was
+    // emitted last.
+    bool        m_provisionalEmitted;
+    Seiscomp::Core::Time m_lastProvisional;
+
+    // Whether a provisional amplitude is being emitted.
+    bool        m_emittingProvisional;
 };
 
 /*
-Calculates the MLa  magnitude. There are 3 geographical
+Calculates the MLa  magnitude. By default there are 3 geographical
 regions defined for this magnitude type: West, East, and South. Each region has
-a different formula for calculating the magnitude type associated with it.
-The formula used is the one which corresponds with which region the source
-information is located within. The region extents are defined by a .bna file.
+a different set of coefficients for the general MLa formula (see
+MLaCoefficients). The formula used is the one which corresponds with which
+region the source information is located within. The region extents are
+defined by a .bna file, further regions and their coefficients can be added
+through the configuration.
+
+Once set up, one processor may compute magnitudes in several threads at once.
+Computations only read the processor: the regions and station corrections
+are read through hazard pointers (see MLaProtected) and switched to reloaded
+versions without stopping other computations, the region cache is kept per
+thread. setup() must not run concurrently with computations.
 */
 class Magnitude_MLA : public Seiscomp::Processing::MagnitudeProcessor
 {
-    // Typedef the member function pointer for the different formulas of magnitude
-    // calculation.
-    typedef Seiscomp::Processing::MagnitudeProcessor::Status (Magnitude_MLA::*MagCalc)(
-        double amplitude,   // in millimetres
-        double period,      // in seconds
-        double delta,       // in degrees
-        double depth,       // in kilometres
-        double &value);
-
     public:
 
         /*#####################################################################
@@ -127,7 +287,7 @@ class Magnitude_MLA : public Seiscomp::Processing::MagnitudeProcessor
         // Constructor. Return a new Magnitude_MLA object.
         Magnitude_MLA();
 
-        // Destructor. Cleans up all data created on the heap.
+        // Destructor.
         virtual ~Magnitude_MLA();
 
         // Configures the plugin to get all the relevant information it
@@ -141,7 +301,11 @@ class Magnitude_MLA : public Seiscomp::Processing::MagnitudeProcessor
         // the name of the amplitude type from scamp that you want to use.
         std::string amplitudeType() const;
 
-        // Calculates the ml magnitude with the given parameters.
+        // Calculates the ml magnitude with the given parameters, including
+        // the correction of the station (see stationCorrection()). The
+        // station is taken from the receiver or else from the waveform ID of
+        // the amplitude, without either the station of the binding is
+        // assumed.
         // @param amplitude: Amplitude of the seismic event (in millimetres).
         // @param period: (in seconds).
         // @param delta: (in degrees).
@@ -167,6 +331,79 @@ class Magnitude_MLA : public Seiscomp::Processing::MagnitudeProcessor
 #endif
               double &value);
 
+        /*
+        Calculates the station magnitudes of several amplitudes of one origin
+        at once. The region of the origin is resolved once and the formula is
+        evaluated several stations at a time with vector instructions. The
+        results are within MLaBatchMaxError (see vectormath.h) of the exact
+        formula, which computeMagnitude() evaluates unless
+        mla.attenuationTable is enabled; with the tables its results may
+        differ from these by up to MLaAttenuationMaxError (see
+        attenuation.h).
+
+        @param hypocenter: The origin all amplitudes belong to.
+        @param count: The number of amplitudes.
+        @param amplitudes: The amplitudes (in millimetres).
+        @param deltas: The epicentral distances of the stations (in degrees).
+        @param depths: The depths of the hypocentre (in kms), one per
+                       amplitude.
+        @param values: Receives count magnitudes, without station
+                       corrections as the stations are not known here. Add
+                       stationCorrection() of each station.
+        @returns OK, or DistanceOutOfRange if the origin is not within any
+                 configured zone, in which case values is left untouched.
+        */
+        Seiscomp::Processing::MagnitudeProcessor::Status computeMagnitudes(
+              const Seiscomp::DataModel::Origin *hypocenter,
+              size_t count,
+              const double *amplitudes,   // in millimetres
+              const double *deltas,       // in degrees
+              const double *depths,       // in kilometres
+              double *values);
+
+        /*
+        Returns the zone an epicentre falls within, without the region
+        cache.
+
+        @param latitude: The latitude of the epicentre (in degrees).
+        @param longitude: The longitude of the epicentre (in degrees).
+        @returns The zone ID or -1 if the epicentre is not within any
+                 configured zone or no regions are loaded.
+        */
+        int zone(double latitude, double longitude) const;
+
+        // Returns the names of the configured zones, indexed by zone ID.
+        const std::vector<std::string> &zoneNames() const { return m_zoneNames; }
+
+        /*
+        Calculates a station magnitude in a zone the way computeMagnitude()
+        does, without the station correction.
+
+        @param zone: The zone ID, see zone().
+        @param amplitude: Amplitude of the seismic event (in millimetres).
+        @param delta: (in degrees).
+        @param depth: the depth of the epicentre of the event (in kms).
+        @returns The magnitude.
+        */
+        double zoneMagnitude(int zone, double amplitude, double delta, double depth) const;
+
+        /*
+        Returns the correction of a station: mla.stationCorrection if the
+        processor was set up for this network and station code, whatever
+        the location code, and it is configured in its binding, else the
+        correction of the station correction file (mla.stationCorrectionFile)
+        for the stream if it lists it, else 0.
+        Corrections reloaded from the file are picked up here.
+
+        @param network: The network code.
+        @param station: The station code.
+        @param location: The location code.
+        @returns The correction to add to the station magnitude.
+        */
+        double stationCorrection(const std::string &network,
+                                 const std::string &station,
+                                 const std::string &location) const;
+
         /*#####################################################################
                                             STATIC METHODS
         #####################################################################*/
@@ -181,105 +418,176 @@ class Magnitude_MLA : public Seiscomp::Processing::MagnitudeProcessor
         */
         static double distance(double delta, double depth);
 
+        /*
+        Calculates the square of distance(), the argument of the
+        attenuation tables.
+
+        @param delta: (in degrees).
+        @param depth: the depth of the epicentre of the event (in kms).
+        @returns The squared distance (in km^2).
+        */
+        static double squaredDistance(double delta, double depth);
+
+        /*
+        Evaluates the general MLa formula.
+
+        @param coefficients: The coefficients of the region.
+        @param amplitude: Amplitude of the seismic event (in millimetres).
+        @param r: The distance (R component) in kilometres.
+        @returns The magnitude.
+        */
+        static double formula(const MLaCoefficients &coefficients,
+                              double amplitude, double r)
+        {
+            return (
+                    coefficients.c0 * log10(amplitude) +
+                    (coefficients.c1 * log10(r * coefficients.c3 + coefficients.c4)) +
+                    (coefficients.c5 * (r + coefficients.c6)) + coefficients.c2);
+        }
+
     private:
 
+        /*#####################################################################
+                                                PRIVATE TYPES
+        #####################################################################*/
+
+        /*
+        The regions in use and the zone of each of them. Immutable, it is
+        replaced as a whole when the regions are reloaded, so every
+        computation sees regions and zones which belong together.
+        */
+        struct RegionState
+        {
+            // Shared with all other processors configured with the same bna
+            // file.
+            MLaRegionSetPtr     regions;
+
+            // Zone ID of every region, in region order. -1 for regions
+            // without a configured zone.
+            std::vector<int>    featureZones;
+        };
+
         /*#####################################################################
                                     PRIVATE MEMBER VARIABLES
         #####################################################################*/
 
         /*
         The dataset representing the geographical regions which are used to
-        determine which formula to use.
+        determine which formula to use, and the zones of its regions.
         */
-        Seiscomp::Geo::GeoFeatureSet        *m_regions;
+        mutable MLaProtected<RegionState>   m_regions;
 
         /*
-        The category for all the GeoFeatures in the m_regions GeoFeatureSet
-        from the bna file.
+        The watch on the bna file if mla.reloadInterval is set, and the
+        generation of m_regions. Reloaded regions are picked up at the next
+        computation.
         */
-        Seiscomp::Geo::Category                 *m_fileCat;
+        MLaRegionWatchPtr                   m_watch;
+        mutable std::atomic<unsigned>       m_regionsGeneration;
+
+        /*
+        The corrections of the station correction file if one is configured,
+        shared with all other processors configured with the same file. With
+        mla.reloadInterval set the file is watched, and m_correctionsGeneration
+        is the generation of m_corrections.
+        */
+        mutable MLaProtected<MLaStationCorrections> m_corrections;
+        MLaStationCorrectionWatchPtr        m_correctionWatch;
+        mutable std::atomic<unsigned>       m_correctionsGeneration;
+
+        // Serializes switching to reloaded regions and corrections.
+        mutable std::mutex                  m_reloadMutex;
+
+        // mla.stationCorrection of the binding of the station the processor
+        // was set up for, if configured.
+        bool                                m_hasBindingCorrection;
+        double                              m_bindingCorrection;
+        std::string                         m_bindingNetwork;
+        std::string                         m_bindingStation;
+
+        // Names of the configured zones, indexed by zone ID.
+        std::vector<std::string>            m_zoneNames;
+
+        // MLaStatistics slots of the configured zones, indexed by zone ID.
+        std::vector<int>                    m_zoneSlots;
+
+        // Formula coefficients of the configured zones, indexed by zone ID.
+        std::vector<MLaCoefficients>        m_zones;
 
         /*
-        Maps the name of the region to the member function which is used to
-        calculate the magnitude for that region.
+        Tabulated distance corrections of the configured zones, indexed by
+        zone ID. Only used if mla.attenuationTable is enabled and the table
+        of the zone passed its verification.
         */
-        std::map<std::string, MagCalc>     m_regionToCalcMap;
+        std::vector<MLaAttenuationTable>    m_attenuations;
+        bool                                m_useAttenuationTables;
 
         /*#####################################################################
                                                 PRIVATE METHODS
         #####################################################################*/
 
         /*
-        Initialises the std::map which ties a region to the member function
-        which performs the calculation for that region.
+        Reads the zones and their coefficients from the configuration. Zones
+        not configured explicitly fall back to the built-in coefficients of
+        West, East and South.
+
+        @param settings: The processor settings.
+        @returns false if a zone has no or invalid coefficients.
         */
-        void setupRegionToCalc();
+        bool setupZones(const Seiscomp::Processing::Settings &settings);
 
         /*
-        Calculates the ml magnitude for the west region (Western Australia).
-        The formula for this region is as follows:
-        log10(A)+1.137log10(R)+0.000657*R+0.66
+        Reads the raster to put in front of the regions from the
+        configuration.
 
-        Where A is the amplitude from vertical component as a maximum
-        displacement in millimetres of Wood-Anderson instrument and R is the
-        distance in kilometres.
-
-        @param amplitude: Amplitude of the seismic event (in millimetres).
-        @param period: (in seconds).
-        @param delta: (in degrees).
-        @param depth: the depth of the epicentre of the event (in kms).
-        @param value: The result of the calculation.*/
-        Seiscomp::Processing::MagnitudeProcessor::Status computeMagWest(
-		      double amplitude,   // in millimetres
-		      double period,      // in seconds
-		      double delta,       // in degrees
-		      double depth,       // in kilometres
-		      double &value);
+        @param settings: The processor settings.
+        @param raster: Set to the configured raster, no raster by default.
+        @returns false if the raster box is malformed.
+        */
+        bool setupRaster(const Seiscomp::Processing::Settings &settings,
+                         MLaRasterSpec &raster);
 
         /*
-        Calculates the ml magnitude for the east region (Eastern Australia).
-        The formula for this region is as follows:
-        log10(A)+1.34log10(R/100)+0.00055*(R-100)+3.13
+        Reads the station correction file and the binding correction from
+        the configuration.
 
-        Where A is the amplitude from vertical component as a maximum
-        displacement in millimetres of Wood-Anderson instrument and R is the
-        distance in kilometres.
-
-        @param amplitude: Amplitude of the seismic event (in millimetres).
-        @param period: (in seconds).
-        @param delta: (in degrees).
-        @param depth: the depth of the epicentre of the event (in kms).
-        @param value: The result of the calculation
+        @param settings: The processor settings.
+        @param reloadInterval: mla.reloadInterval.
+        @returns false if a configured station correction file can not be
+                 read.
         */
-        Seiscomp::Processing::MagnitudeProcessor::Status computeMagEast(
-		      double amplitude,   // in millimetres
-		      double period,      // in seconds
-		      double delta,       // in degrees
-		      double depth,       // in kilometres
-		      double &value);
+        bool setupCorrections(const Seiscomp::Processing::Settings &settings,
+                              double reloadInterval);
 
         /*
-        Calculates the ml magnitude for the south region (Flinders Ranges).
-        The formula for this region is as follows:
-        log10(A)+1.1log10(R)+0.0013*R+0.7
+        Maps the regions of a region set to the configured zones and makes
+        them the regions in use. The previous regions are released once no
+        thread uses them anymore, see refresh().
+        */
+        void useRegions(const MLaRegionSetPtr &regions) const;
 
-        Where A is the amplitude from vertical component as a maximum
-        displacement in millimetres of Wood-Anderson instrument and R is the
-        distance in kilometres.
+        /*
+        Switches to regions and corrections reloaded since the last call and
+        releases previous ones no thread reads anymore. Never waits: if
+        another thread is switching, the call returns and the computation
+        goes on with the versions it finds.
+        */
+        void refresh() const;
 
-        @param amplitude: Amplitude of the seismic event (in millimetres).
-        @param period: (in seconds).
-        @param delta: (in degrees).
-        @param depth: the depth of the epicentre of the event (in kms).
-        @param value: The result of the calculation.
+        /*
+        Returns the zone ID for the region the epicentre of the origin falls
+        within, consulting the region cache of the calling thread first. The
+        cache holds regions rather than zones, keyed by the region set, so
+        it serves all processors sharing the region set.
+
+        @param hypocenter: The origin.
+        @returns The zone ID or -1 if the epicentre is not within any
+                 configured zone or no regions are loaded.
         */
-        Seiscomp::Processing::MagnitudeProcessor::Status computeMagSouth(
-		      double amplitude,   // in millimetres
-		      double period,      // in seconds
-		      double delta,       // in degrees
-		      double depth,       // in kilometres
-		      double &value);
+        int resolveZone(const Seiscomp::DataModel::Origin *hypocenter) const;
 
+        // Returns the zone ID of an epicentre in a region state.
+        static int findZone(const RegionState &state, double latitude, double longitude);
 };
 
 #endif /* __MLA_PLUGIN_H__ */
@@ -0,0 +1,498 @@
+/*
+ * File:   mlamodule.cpp
+ *
+ * Python module (mla) computing MLa with the plugin sources, for batches of
+ * station magnitudes held in NumPy arrays or any other object supporting
+ * the buffer protocol:
+ *
+ *     import mla, numpy
+ *     processor = mla.Processor({"mla.regionfilepath": "zones.bna"})
+ *     zones = numpy.frombuffer(processor.zones(lats, lons), dtype=numpy.int32)
+ *     values = numpy.empty(len(lats))
+ *     processor.magnitudes(lats, lons, amplitudes, deltas, depths, out=values)
+ *
+ * Input arrays are read in place, they have to be contiguous float64 arrays
+ * of the same length. Results are written to out if it is given (a writable
+ * contiguous float64 or int32 array), otherwise to a new buffer returned as
+ * a memoryview. The GIL is released while a batch is computed, so several
+ * threads can compute batches at once, also with the same processor.
+ *
+ * The zones are resolved and the magnitudes computed by Magnitude_MLA, so
+ * results are identical to those of computeMagnitude() without station
+ * corrections. With mla.reloadInterval set, reloaded region files are
+ * switched to between two epicentres.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define SEISCOMP_COMPONENT MLa
+
+#include "../mla.h"
+
+#include <seiscomp/config/config.h>
+#include <seiscomp/utils/keyvalues.h>
+
+#include <limits>
+#include <string.h>
+
+
+namespace {
+
+struct ProcessorObject
+{
+    PyObject_HEAD
+    Magnitude_MLA *processor;
+};
+
+// A buffer released when leaving the scope.
+class Buffer
+{
+    public:
+
+        Buffer() : m_valid(false) {}
+
+        ~Buffer()
+        {
+            if (m_valid)
+            {
+                PyBuffer_Release(&m_view);
+            }
+        }
+
+        /*
+        Gets the buffer of an array of a type.
+
+        @param object: The array.
+        @param name: The name of the argument, for error messages.
+        @param type: 'd' for float64, 'i' for int32.
+        @param writable: Whether the array is written to.
+        @returns false with a Python exception set if the object does not
+                 support the buffer protocol or is not a contiguous array of
+                 the type.
+        */
+        bool get(PyObject *object, const char *name, char type, bool writable)
+        {
+            int flags = PyBUF_FORMAT | PyBUF_ND | PyBUF_C_CONTIGUOUS;
+            if (writable)
+            {
+                flags |= PyBUF_WRITABLE;
+            }
+            if (PyObject_GetBuffer(object, &m_view, flags) != 0)
+            {
+                return false;
+            }
+            m_valid = true;
+
+            const Py_ssize_t itemSize = type == 'd' ? 8 : 4;
+            if (m_view.ndim > 1 || m_view.itemsize != itemSize || !native(m_view.format, type))
+            {
+                PyErr_Format(PyExc_TypeError, "%s must be a contiguous one-dimensional %s array",
+                             name, type == 'd' ? "float64" : "int32");
+                return false;
+            }
+            return true;
+        }
+
+        Py_ssize_t size() const { return m_view.len / m_view.itemsize; }
+
+        void *data() const { return m_view.buf; }
+
+    private:
+
+        // Whether a struct format is a native or little endian type.
+        static bool native(const char *format, char type)
+        {
+            if (format == NULL)
+            {
+                return false;
+            }
+            if (*format == '@' || *format == '=' || *format == '<')
+            {
+                if (*format == '<' && !littleEndian())
+                {
+                    return false;
+                }
+                format++;
+            }
+            if (type == 'i')
+            {
+                return (format[0] == 'i' || format[0] == 'l') && format[1] == '\0';
+            }
+            return format[0] == type && format[1] == '\0';
+        }
+
+        static bool littleEndian()
+        {
+            const uint16_t one = 1;
+            return *(const uint8_t*)&one == 1;
+        }
+
+        Py_buffer   m_view;
+        bool        m_valid;
+};
+
+/*
+Gets the output buffer of a batch: out if given, otherwise a new bytearray
+of count items of the type, returned in result as a memoryview.
+*/
+bool output(PyObject *out, char type, Py_ssize_t count, Buffer &buffer, PyObject *&result)
+{
+    if (out != NULL && out != Py_None)
+    {
+        if (!buffer.get(out, "out", type, true))
+        {
+            return false;
+        }
+        if (buffer.size() != count)
+        {
+            PyErr_SetString(PyExc_ValueError, "out must have the length of the inputs");
+            return false;
+        }
+        Py_INCREF(out);
+        result = out;
+        return true;
+    }
+
+    PyObject *bytes = PyByteArray_FromStringAndSize(NULL, count * (type == 'd' ? 8 : 4));
+    if (bytes == NULL)
+    {
+        return false;
+    }
+    PyObject *view = PyMemoryView_FromObject(bytes);
+    Py_DECREF(bytes);
+    if (view == NULL)
+    {
+        return false;
+    }
+    result = PyObject_CallMethod(view, "cast", "s", type == 'd' ? "d" : "i");
+    Py_DECREF(view);
+    if (result == NULL)
+    {
+        return false;
+    }
+    if (!buffer.get(result, "out", type, true))
+    {
+        Py_CLEAR(result);
+        return false;
+    }
+    return true;
+}
+
+// Gets the input arrays of a batch, all of the same length.
+bool inputs(PyObject **objects, const char **names, Buffer *buffers, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!buffers[i].get(objects[i], names[i], 'd', false))
+        {
+            return false;
+        }
+        if (buffers[i].size() != buffers[0].size())
+        {
+            PyErr_Format(PyExc_ValueError, "%s must have the length of %s", names[i], names[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int processorInit(ProcessorObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *keywords[] = { "settings", "config", NULL };
+    PyObject *settings = NULL;
+    const char *configFile = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O!z", (char**)keywords,
+                                     &PyDict_Type, &settings, &configFile))
+    {
+        return -1;
+    }
+
+    // Methods running in other threads may be using the processor, it is
+    // never replaced.
+    if (self->processor != NULL)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "the processor is set up already");
+        return -1;
+    }
+
+    Seiscomp::Config::Config config;
+    if (configFile != NULL && !config.readConfig(configFile))
+    {
+        PyErr_Format(PyExc_IOError, "can not read %s", configFile);
+        return -1;
+    }
+
+    Seiscomp::Util::KeyValues keys;
+    if (settings != NULL)
+    {
+        PyObject *key, *value;
+        Py_ssize_t position = 0;
+        while (PyDict_Next(settings, &position, &key, &value))
+        {
+            PyObject *text = PyObject_Str(value);
+            if (text == NULL)
+            {
+                return -1;
+            }
+            const char *name = PyUnicode_AsUTF8(key);
+            const char *setting = PyUnicode_AsUTF8(text);
+            if (name == NULL || setting == NULL)
+            {
+                Py_DECREF(text);
+                return -1;
+            }
+            keys.setString(name, setting);
+            Py_DECREF(text);
+        }
+    }
+
+    // Settings keeps references to the codes.
+    const std::string module("mla"), none;
+    Seiscomp::Processing::Settings processorSettings(
+        module, none, none, none, none, &config, &keys);
+
+    Magnitude_MLA *processor = new Magnitude_MLA;
+    if (!processor->setup(processorSettings))
+    {
+        delete processor;
+        PyErr_SetString(PyExc_ValueError, "can not set up the MLa magnitude processor");
+        return -1;
+    }
+
+    self->processor = processor;
+    return 0;
+}
+
+void processorDealloc(ProcessorObject *self)
+{
+    delete self->processor;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+bool ready(ProcessorObject *self)
+{
+    if (self->processor == NULL)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "the processor is not set up");
+        return false;
+    }
+    return true;
+}
+
+PyObject *processorZones(ProcessorObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *keywords[] = { "latitudes", "longitudes", "out", NULL };
+    PyObject *objects[2];
+    PyObject *out = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|O", (char**)keywords,
+                                     &objects[0], &objects[1], &out) ||
+        !ready(self))
+    {
+        return NULL;
+    }
+
+    static const char *names[] = { "latitudes", "longitudes" };
+    Buffer buffers[2];
+    Buffer result;
+    PyObject *resultObject = NULL;
+    if (!inputs(objects, names, buffers, 2) ||
+        !output(out, 'i', buffers[0].size(), result, resultObject))
+    {
+        return NULL;
+    }
+
+    const Magnitude_MLA &processor = *self->processor;
+    const double *lats = (const double*)buffers[0].data();
+    const double *lons = (const double*)buffers[1].data();
+    int32_t *zones = (int32_t*)result.data();
+    const Py_ssize_t count = buffers[0].size();
+
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < count; i++)
+    {
+        // Rows are typically grouped by origin.
+        if (i > 0 && lats[i] == lats[i - 1] && lons[i] == lons[i - 1])
+        {
+            zones[i] = zones[i - 1];
+        }
+        else
+        {
+            zones[i] = processor.zone(lats[i], lons[i]);
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    return resultObject;
+}
+
+PyObject *processorMagnitudes(ProcessorObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *keywords[] = {
+        "latitudes", "longitudes", "amplitudes", "deltas", "depths", "out", NULL
+    };
+    PyObject *objects[5];
+    PyObject *out = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOO|O", (char**)keywords,
+                                     &objects[0], &objects[1], &objects[2],
+                                     &objects[3], &objects[4], &out) ||
+        !ready(self))
+    {
+        return NULL;
+    }
+
+    static const char *names[] = { "latitudes", "longitudes", "amplitudes", "deltas", "depths" };
+    Buffer buffers[5];
+    Buffer result;
+    PyObject *resultObject = NULL;
+    if (!inputs(objects, names, buffers, 5) ||
+        !output(out, 'd', buffers[0].size(), result, resultObject))
+    {
+        return NULL;
+    }
+
+    const Magnitude_MLA &processor = *self->processor;
+    const double *lats = (const double*)buffers[0].data();
+    const double *lons = (const double*)buffers[1].data();
+    const double *amplitudes = (const double*)buffers[2].data();
+    const double *deltas = (const double*)buffers[3].data();
+    const double *depths = (const double*)buffers[4].data();
+    double *values = (double*)result.data();
+    const Py_ssize_t count = buffers[0].size();
+
+    Py_BEGIN_ALLOW_THREADS
+    int zone = -1;
+    for (Py_ssize_t i = 0; i < count; i++)
+    {
+        if (i == 0 || lats[i] != lats[i - 1] || lons[i] != lons[i - 1])
+        {
+            zone = processor.zone(lats[i], lons[i]);
+        }
+
+        // Outside of all zones computeMagnitude() gives DistanceOutOfRange.
+        values[i] = zone >= 0 ?
+            processor.zoneMagnitude(zone, amplitudes[i], deltas[i], depths[i]) :
+            std::numeric_limits<double>::quiet_NaN();
+    }
+    Py_END_ALLOW_THREADS
+
+    return resultObject;
+}
+
+PyObject *processorStationCorrection(ProcessorObject *self, PyObject *args)
+{
+    const char *network, *station, *location;
+    if (!PyArg_ParseTuple(args, "sss", &network, &station, &location) || !ready(self))
+    {
+        return NULL;
+    }
+    return PyFloat_FromDouble(self->processor->stationCorrection(network, station, location));
+}
+
+PyObject *processorZoneNames(ProcessorObject *self, void *)
+{
+    if (!ready(self))
+    {
+        return NULL;
+    }
+
+    const std::vector<std::string> &names = self->processor->zoneNames();
+    PyObject *result = PyTuple_New((Py_ssize_t)names.size());
+    if (result == NULL)
+    {
+        return NULL;
+    }
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        PyObject *name = PyUnicode_FromString(names[i].c_str());
+        if (name == NULL)
+        {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(result, (Py_ssize_t)i, name);
+    }
+    return result;
+}
+
+PyMethodDef processorMethods[] = {
+    {
+        "zones", (PyCFunction)(void(*)(void))processorZones, METH_VARARGS | METH_KEYWORDS,
+        "zones(latitudes, longitudes, out=None)\n\n"
+        "Returns the zone ID (an index into zone_names) of every epicentre, "
+        "-1 outside of all zones, as int32."
+    },
+    {
+        "magnitudes", (PyCFunction)(void(*)(void))processorMagnitudes, METH_VARARGS | METH_KEYWORDS,
+        "magnitudes(latitudes, longitudes, amplitudes, deltas, depths, out=None)\n\n"
+        "Returns the station magnitudes of amplitudes (in millimetres) at "
+        "epicentral distances (in degrees) from epicentres at depths (in "
+        "kilometres), as float64, without station corrections. NaN where "
+        "the epicentre is outside of all zones."
+    },
+    {
+        "station_correction", (PyCFunction)processorStationCorrection, METH_VARARGS,
+        "station_correction(network, station, location)\n\n"
+        "Returns the station correction to add to station magnitudes of a "
+        "station."
+    },
+    { NULL, NULL, 0, NULL }
+};
+
+PyGetSetDef processorGetSet[] = {
+    {
+        (char*)"zone_names", (getter)processorZoneNames, NULL,
+        (char*)"The names of the configured zones, indexed by zone ID.", NULL
+    },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+PyTypeObject ProcessorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+};
+
+PyModuleDef module = {
+    PyModuleDef_HEAD_INIT,
+    "mla",
+    "MLa station magnitudes of batches of amplitudes, computed by the mla "
+    "plugin.",
+    -1,
+    NULL, NULL, NULL, NULL, NULL
+};
+
+}
+
+PyMODINIT_FUNC PyInit_mla(void)
+{
+    ProcessorType.tp_name = "mla.Processor";
+    ProcessorType.tp_basicsize = sizeof(ProcessorObject);
+    ProcessorType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ProcessorType.tp_doc =
+        "Processor(settings=None, config=None)\n\n"
+        "An MLa magnitude processor configured with the mla.* parameters of "
+        "the settings dictionary and the configuration file.";
+    ProcessorType.tp_new = PyType_GenericNew;
+    ProcessorType.tp_init = (initproc)processorInit;
+    ProcessorType.tp_dealloc = (destructor)processorDealloc;
+    ProcessorType.tp_methods = processorMethods;
+    ProcessorType.tp_getset = processorGetSet;
+    if (PyType_Ready(&ProcessorType) < 0)
+    {
+        return NULL;
+    }
+
+    PyObject *result = PyModule_Create(&module);
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    Py_INCREF(&ProcessorType);
+    if (PyModule_AddObject(result, "Processor", (PyObject*)&ProcessorType) < 0)
+    {
+        Py_DECREF(&ProcessorType);
+        Py_DECREF(result);
+        return NULL;
+    }
+    return result;
+}
@@ -0,0 +1,202 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "regionindex.h"
+
+#if SC_API_VERSION < SC_API_VERSION_CHECK(12,0,0)
+#include <seiscomp/geo/geofeature.h>
+#else
+#include <seiscomp/geo/feature.h>
+#endif
+
+#include <algorithm>
+#include <iterator>
+#include <math.h>
+
+
+// The zone polygons are a few degrees across, half a degree cells give one or
+// two candidates per cell while keeping the grid for all of Australia small.
+const double MLaRegionIndex::CellSize = 0.5;
+
+MLaRegionIndex::MLaRegionIndex()
+    : m_latMin(0), m_lonMin(0), m_rows(0), m_cols(0)
+{
+}
+
+bool MLaRegionIndex::boundingBox(const Seiscomp::Geo::GeoFeature *feature,
+                                 BoundingBox &box)
+{
+    const std::vector<Seiscomp::Geo::Vertex> &vertices = feature->vertices();
+    if (vertices.empty())
+    {
+        return false;
+    }
+
+    box.latMin = box.latMax = vertices[0].lat;
+    box.lonMin = box.lonMax = vertices[0].lon;
+
+    // A great circle segment can bulge towards the pole by at most about
+    // dLon^2/8 radians compared to its chord in the lat/lon plane. Its
+    // longitude stays between the longitudes of its end points.
+    double bulge = 0;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        const Seiscomp::Geo::Vertex &v = vertices[i];
+        const Seiscomp::Geo::Vertex &prev =
+            vertices[i == 0 ? vertices.size() - 1 : i - 1];
+
+        box.latMin = std::min(box.latMin, (double)v.lat);
+        box.latMax = std::max(box.latMax, (double)v.lat);
+        box.lonMin = std::min(box.lonMin, (double)v.lon);
+        box.lonMax = std::max(box.lonMax, (double)v.lon);
+
+        double dLon = fabs((double)v.lon - (double)prev.lon) * M_PI / 180.0;
+        bulge = std::max(bulge, dLon * dLon / 8.0 * 180.0 / M_PI);
+    }
+
+    // Polygons wrapping around the globe or crossing the date line are
+    // left to the linear scan.
+    if (!(box.lonMax - box.lonMin <= 180.0) ||
+        !(box.latMax - box.latMin <= 180.0))
+    {
+        return false;
+    }
+
+    // Guard against rounding of the float vertices.
+    const double eps = 1E-6;
+    box.latMin -= bulge + eps;
+    box.latMax += bulge + eps;
+    box.lonMin -= eps;
+    box.lonMax += eps;
+
+    return true;
+}
+
+void MLaRegionIndex::build(const Seiscomp::Geo::GeoFeatureSet &regions)
+{
+    const std::vector<Seiscomp::Geo::GeoFeature*> &features = regions.features();
+
+    std::vector<BoundingBox> boxes(features.size());
+    for (size_t i = 0; i < features.size(); i++)
+    {
+        if (!boundingBox(features[i], boxes[i]))
+        {
+            boxes[i].latMin = boxes[i].lonMin = -HUGE_VAL;
+            boxes[i].latMax = boxes[i].lonMax = HUGE_VAL;
+        }
+    }
+
+    build(boxes);
+    m_features.assign(features.begin(), features.end());
+}
+
+void MLaRegionIndex::build(const std::vector<BoundingBox> &boxes)
+{
+    m_features.clear();
+    m_boxes = boxes;
+    m_unindexed.clear();
+    m_cellStart.clear();
+    m_cellFeatures.clear();
+    m_rows = m_cols = 0;
+
+    std::vector<int> indexed;
+    BoundingBox extent = BoundingBox();
+    for (size_t i = 0; i < m_boxes.size(); i++)
+    {
+        const BoundingBox &box = m_boxes[i];
+        if (!(box.latMin > -HUGE_VAL && box.latMax < HUGE_VAL &&
+              box.lonMin > -HUGE_VAL && box.lonMax < HUGE_VAL))
+        {
+            m_unindexed.push_back(i);
+            continue;
+        }
+
+        if (indexed.empty())
+        {
+            extent = box;
+        }
+        else
+        {
+            extent.latMin = std::min(extent.latMin, box.latMin);
+            extent.latMax = std::max(extent.latMax, box.latMax);
+            extent.lonMin = std::min(extent.lonMin, box.lonMin);
+            extent.lonMax = std::max(extent.lonMax, box.lonMax);
+        }
+        indexed.push_back(i);
+    }
+
+    // The grid lookup relies on a location having at most one longitude
+    // alias inside of the grid. If the regions are spread around the whole
+    // globe, do not bother with a grid at all.
+    if (indexed.empty() || extent.lonMax - extent.lonMin >= 360.0 - 2 * CellSize)
+    {
+        m_unindexed.clear();
+        for (size_t i = 0; i < m_boxes.size(); i++)
+        {
+            m_unindexed.push_back(i);
+        }
+        return;
+    }
+
+    m_latMin = extent.latMin;
+    m_lonMin = extent.lonMin;
+    m_rows = std::max(1, (int)ceil((extent.latMax - extent.latMin) / CellSize));
+    m_cols = std::max(1, (int)ceil((extent.lonMax - extent.lonMin) / CellSize));
+
+    // Register every region in all cells its box overlaps, plus one cell of
+    // margin so that rounding at cell borders can never lose a candidate.
+    // Iterating in region order keeps the cell lists sorted.
+    std::vector< std::vector<int> > cells(m_rows * m_cols);
+    for (size_t k = 0; k < indexed.size(); k++)
+    {
+        const BoundingBox &box = m_boxes[indexed[k]];
+        int r0 = std::max(0, (int)floor((box.latMin - m_latMin) / CellSize) - 1);
+        int r1 = std::min(m_rows - 1, (int)floor((box.latMax - m_latMin) / CellSize) + 1);
+        int c0 = std::max(0, (int)floor((box.lonMin - m_lonMin) / CellSize) - 1);
+        int c1 = std::min(m_cols - 1, (int)floor((box.lonMax - m_lonMin) / CellSize) + 1);
+        for (int r = r0; r <= r1; r++)
+        {
+            for (int c = c0; c <= c1; c++)
+            {
+                cells[r * m_cols + c].push_back(indexed[k]);
+            }
+        }
+    }
+
+    m_cellStart.reserve(cells.size() + 1);
+    for (size_t c = 0; c < cells.size(); c++)
+    {
+        m_cellStart.push_back(m_cellFeatures.size());
+        std::merge(cells[c].begin(), cells[c].end(),
+                   m_unindexed.begin(), m_unindexed.end(),
+                   std::back_inserter(m_cellFeatures));
+    }
+    m_cellStart.push_back(m_cellFeatures.size());
+}
+
+int MLaRegionIndex::cell(double lat, double lon) const
+{
+    if (m_rows == 0)
+    {
+        return -1;
+    }
+
+    static const double shifts[] = { 0.0, 360.0, -360.0 };
+    for (int i = 0; i < 3; i++)
+    {
+        double r = (lat - m_latMin) / CellSize;
+        double c = (lon + shifts[i] - m_lonMin) / CellSize;
+        if (r >= 0 && r <= m_rows && c >= 0 && c <= m_cols)
+        {
+            return std::min((int)r, m_rows - 1) * m_cols +
+                   std::min((int)c, m_cols - 1);
+        }
+    }
+
+    return -1;
+}
+
+int MLaRegionIndex::find(const Seiscomp::Geo::Vertex &location) const
+{
+    FeatureContains contains = { this, &location };
+    return find(location, contains);
+}
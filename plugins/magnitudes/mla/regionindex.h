@@ -0,0 +1,239 @@
+/*
+ * File:   regionindex.h
+ */
+
+#ifndef __MLA_REGIONINDEX_H__
+#define __MLA_REGIONINDEX_H__
+
+#include <seiscomp/core/plugin.h>
+#if SC_API_VERSION < SC_API_VERSION_CHECK(12,0,0)
+#include <seiscomp/geo/geofeatureset.h>
+#else
+#include <seiscomp/geo/featureset.h>
+#endif
+
+#include <vector>
+
+/*
+Spatial index over the regions of a GeoFeatureSet. The index is built once
+from the features of the set and answers the question "which is the first
+feature (in file order) containing this location", which is exactly what a
+linear scan calling GeoFeature::contains() on every feature answers.
+
+Every feature gets a conservative bounding box. The bounding boxes of all
+features are then registered in a uniform grid covering their combined
+extent, so a lookup only has to look at the (usually one or two) features
+whose bounding box touches the grid cell of the location. The final decision
+is always made by GeoFeature::contains(), so results are identical to the
+linear scan, including for locations on polygon edges.
+*/
+class MLaRegionIndex
+{
+    public:
+
+        /*#####################################################################
+                                                PUBLIC TYPES
+        #####################################################################*/
+
+        /*
+        Axis aligned bounding box in degrees. The box is closed, i.e.
+        locations on its border are considered to be inside.
+        */
+        struct BoundingBox
+        {
+            double latMin, latMax;
+            double lonMin, lonMax;
+
+            // Tests the location without longitude normalisation.
+            bool containsPlain(double lat, double lon) const
+            {
+                return lat >= latMin && lat <= latMax &&
+                       lon >= lonMin && lon <= lonMax;
+            }
+
+            // Tests the location including its +/-360 degree aliases.
+            bool contains(double lat, double lon) const
+            {
+                return containsPlain(lat, lon) ||
+                       containsPlain(lat, lon + 360.0) ||
+                       containsPlain(lat, lon - 360.0);
+            }
+        };
+
+        /*#####################################################################
+                                            PUBLIC METHODS
+        #####################################################################*/
+
+        // Constructor. Returns an empty index which never finds a region.
+        MLaRegionIndex();
+
+        /*
+        Builds the index for the features of the given set. The index keeps
+        pointers to the features, so the set has to outlive the index (or
+        the index has to be rebuilt when the set changes).
+
+        @param regions: The features to index.
+        */
+        void build(const Seiscomp::Geo::GeoFeatureSet &regions);
+
+        /*
+        Builds the index for regions given by their bounding boxes only, see
+        find(location, contains). Boxes with infinite bounds mark regions
+        which are candidates for every location.
+
+        @param boxes: The bounding box of every region, in region order.
+        */
+        void build(const std::vector<BoundingBox> &boxes);
+
+        /*
+        Returns the position of the first feature of the indexed set which
+        contains the given location.
+
+        @param location: The location to look up.
+        @returns The index of the feature in GeoFeatureSet::features(), or -1
+                 when no feature contains the location.
+        */
+        int find(const Seiscomp::Geo::Vertex &location) const;
+
+        /*
+        Returns the first region whose bounding box contains the location
+        and for which contains returns true.
+
+        @param location: The location to look up.
+        @param contains: Called with a region position, tells whether the
+                         region contains the location.
+        @returns The position of the region or -1.
+        */
+        template <typename Contains>
+        int find(const Seiscomp::Geo::Vertex &location,
+                 const Contains &contains) const;
+
+        /*
+        Returns the feature at the given position of the indexed set.
+
+        @param index: A value returned by find() other than -1.
+        */
+        const Seiscomp::Geo::GeoFeature *feature(int index) const
+        {
+            return m_features[index];
+        }
+
+        /*
+        Returns the bounding box of the region at the given position, with
+        infinite bounds for regions which are candidates everywhere.
+        */
+        const BoundingBox &box(int index) const { return m_boxes[index]; }
+
+        // Returns the number of indexed regions.
+        size_t size() const { return m_boxes.size(); }
+
+        /*
+        Computes the bounding box of a feature. The box is enlarged by the
+        largest deviation of a great circle segment from its chord so that
+        it stays conservative whatever edge interpolation contains() uses.
+
+        @param feature: The feature to compute the box for.
+        @param box: The computed box.
+        @returns false if the feature has no vertices or spans so much
+                 longitude that a box is meaningless.
+        */
+        static bool boundingBox(const Seiscomp::Geo::GeoFeature *feature,
+                                BoundingBox &box);
+
+    private:
+
+        /*#####################################################################
+                                                PRIVATE TYPES
+        #####################################################################*/
+
+        // Decides with GeoFeature::contains().
+        struct FeatureContains
+        {
+            const MLaRegionIndex           *index;
+            const Seiscomp::Geo::Vertex    *location;
+
+            bool operator()(int region) const
+            {
+                return index->m_features[region]->contains(*location);
+            }
+        };
+
+        /*#####################################################################
+                                                PRIVATE METHODS
+        #####################################################################*/
+
+        /*
+        Returns the grid cell of the location or -1 if the location (and its
+        +/-360 degree aliases) is outside of the grid.
+        */
+        int cell(double lat, double lon) const;
+
+        /*#####################################################################
+                                    PRIVATE MEMBER VARIABLES
+        #####################################################################*/
+
+        // Cell size of the grid in degrees.
+        static const double                     CellSize;
+
+        // The indexed features, in file order. Empty if the index was built
+        // from bounding boxes.
+        std::vector<const Seiscomp::Geo::GeoFeature*> m_features;
+
+        // Bounding box per region, in region order.
+        std::vector<BoundingBox>                m_boxes;
+
+        /*
+        Features which are not registered in the grid (no meaningful bounding
+        box). They are candidates for every location.
+        */
+        std::vector<int>                        m_unindexed;
+
+        // Grid origin and dimensions.
+        double                                  m_latMin;
+        double                                  m_lonMin;
+        int                                     m_rows;
+        int                                     m_cols;
+
+        /*
+        Candidate features per grid cell in compressed row storage: the
+        candidates of cell c are m_cellFeatures[m_cellStart[c]] up to
+        m_cellFeatures[m_cellStart[c+1]], sorted by feature index.
+        */
+        std::vector<unsigned int>               m_cellStart;
+        std::vector<int>                        m_cellFeatures;
+};
+
+template <typename Contains>
+int MLaRegionIndex::find(const Seiscomp::Geo::Vertex &location,
+                         const Contains &contains) const
+{
+    const double lat = location.lat;
+    const double lon = location.lon;
+
+    // Outside of the grid only the unindexed regions can match, since the
+    // boxes of all indexed regions lie within the grid.
+    const int *it, *end;
+    int c = cell(lat, lon);
+    if (c < 0)
+    {
+        it = m_unindexed.empty() ? NULL : &m_unindexed[0];
+        end = it + m_unindexed.size();
+    }
+    else
+    {
+        it = m_cellFeatures.empty() ? NULL : &m_cellFeatures[0] + m_cellStart[c];
+        end = it + (m_cellStart[c + 1] - m_cellStart[c]);
+    }
+
+    for (; it != end; ++it)
+    {
+        if (m_boxes[*it].contains(lat, lon) && contains(*it))
+        {
+            return *it;
+        }
+    }
+
+    return -1;
+}
+
+#endif /* __MLA_REGIONINDEX_H__ */
@@ -0,0 +1,386 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "regionraster.h"
+#include "compiledregions.h"
+
+#include <seiscomp/logging/log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/*
+Largest distance in degrees between a location or vertex as tested and its
+value before it was rounded to single precision, with plenty of room for
+the rounding of the crossing test itself.
+*/
+const double RoundingMargin = 1E-4;
+
+// FNV-1a over 64 bit words, the tail byte by byte.
+uint64_t checksum(const uint16_t *cells, size_t count)
+{
+    const unsigned char *bytes = (const unsigned char*)cells;
+    const size_t size = count * sizeof(uint16_t);
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+    for (; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+}
+
+const uint16_t MLaRasterRegionSet::NoRegion;
+const uint16_t MLaRasterRegionSet::Border;
+const size_t MLaRasterRegionSet::MaxCells;
+
+MLaRasterRegionSet::MLaRasterRegionSet(const MLaRegionSetPtr &regions,
+                                       const MLaRasterSpec &raster)
+    : MLaRegionSet(regions->path(), regions->version()), m_regions(regions),
+      m_raster(raster), m_rows(0), m_cols(0), m_scale(1.0 / raster.resolution),
+      m_cells(NULL), m_mapping(NULL), m_mappingSize(0), m_borderCells(0),
+      m_seconds(0)
+{
+}
+
+MLaRasterRegionSet::~MLaRasterRegionSet()
+{
+    if (m_mapping != NULL)
+    {
+        munmap(m_mapping, m_mappingSize);
+    }
+}
+
+std::shared_ptr<MLaRasterRegionSet> MLaRasterRegionSet::create(
+    const MLaRegionSetPtr &regions, const MLaRasterSpec &raster,
+    const std::string &file, std::string &error)
+{
+    std::shared_ptr<MLaRasterRegionSet> rasterised;
+
+    if (!(raster.resolution > 0) || !(raster.latMin < raster.latMax) ||
+        !(raster.lonMin < raster.lonMax) || !isfinite(raster.latMax - raster.latMin) ||
+        !isfinite(raster.lonMax - raster.lonMin))
+    {
+        error = "invalid raster box or resolution";
+        return rasterised;
+    }
+
+    const double rows = ceil((raster.latMax - raster.latMin) / raster.resolution);
+    const double cols = ceil((raster.lonMax - raster.lonMin) / raster.resolution);
+    if (!(rows * cols <= MaxCells))
+    {
+        error = "too many raster cells, increase the resolution";
+        return rasterised;
+    }
+    if (regions->size() >= NoRegion)
+    {
+        error = "too many regions";
+        return rasterised;
+    }
+
+    Clock::time_point start = Clock::now();
+    rasterised.reset(new MLaRasterRegionSet(regions, raster));
+    rasterised->m_rows = std::max(1.0, rows);
+    rasterised->m_cols = std::max(1.0, cols);
+
+    std::string reason;
+    if (!rasterised->open(file, reason))
+    {
+        SEISCOMP_DEBUG("Building the region raster %s: %s", file.c_str(), reason.c_str());
+        rasterised->build();
+        rasterised->m_seconds =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        rasterised->write(file, error);
+        return rasterised;
+    }
+
+    rasterised->m_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return rasterised;
+}
+
+bool MLaRasterRegionSet::open(const std::string &file, std::string &error)
+{
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = strerror(errno);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(MLaRasterHeader))
+    {
+        close(fd);
+        error = "file too short";
+        return false;
+    }
+
+    const size_t size = info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        error = strerror(errno);
+        return false;
+    }
+
+    const MLaRasterHeader *header = (const MLaRasterHeader*)mapping;
+    const uint16_t *cells = (const uint16_t*)(header + 1);
+    const size_t count = (size_t)m_rows * m_cols;
+    if (memcmp(header->magic, MLaRasterMagic, sizeof(MLaRasterMagic)) != 0 ||
+        header->version != MLaRasterVersion ||
+        header->byteOrder != MLaCompiledByteOrder)
+    {
+        error = "not a raster of this version and byte order";
+    }
+    else if (header->sourceMtime != version().mtime || header->sourceSize != version().size ||
+             header->regionCount != m_regions->size())
+    {
+        error = "built from another version of the region file";
+    }
+    else if (header->latMin != m_raster.latMin || header->latMax != m_raster.latMax ||
+             header->lonMin != m_raster.lonMin || header->lonMax != m_raster.lonMax ||
+             header->resolution != m_raster.resolution ||
+             header->rows != m_rows || header->cols != m_cols)
+    {
+        error = "built for another box or resolution";
+    }
+    else if (size != sizeof(MLaRasterHeader) + count * sizeof(uint16_t))
+    {
+        error = "size does not match the header";
+    }
+    else if (checksum(cells, count) != header->checksum)
+    {
+        error = "checksum mismatch";
+    }
+    else
+    {
+        m_mapping = mapping;
+        m_mappingSize = size;
+        m_cells = cells;
+        m_borderCells = header->borderCells;
+        return true;
+    }
+
+    munmap(mapping, size);
+    return false;
+}
+
+void MLaRasterRegionSet::build()
+{
+    m_built.assign((size_t)m_rows * m_cols, NoRegion);
+    m_cells = m_built.data();
+
+    Polygons polygons;
+    for (size_t region = 0; region < m_regions->size(); region++)
+    {
+        m_regions->polygons(region, polygons);
+        for (size_t p = 0; p < polygons.size(); p++)
+        {
+            const std::vector<Seiscomp::Geo::Vertex> &vertices = polygons[p];
+            for (size_t i = 0; i < vertices.size(); i++)
+            {
+                markEdge(vertices[i == 0 ? vertices.size() - 1 : i - 1], vertices[i]);
+            }
+        }
+    }
+
+    // No edge comes close to a run of other cells within a row, a single
+    // exact lookup resolves all of it.
+    m_borderCells = 0;
+    for (uint32_t r = 0; r < m_rows; r++)
+    {
+        uint16_t *row = &m_built[(size_t)r * m_cols];
+        for (uint32_t c = 0; c < m_cols; )
+        {
+            if (row[c] == Border)
+            {
+                m_borderCells++;
+                c++;
+                continue;
+            }
+
+            Seiscomp::Geo::Vertex location;
+            location.lat = m_raster.latMin + (r + 0.5) * m_raster.resolution;
+            location.lon = m_raster.lonMin + (c + 0.5) * m_raster.resolution;
+            int region = m_regions->find(location);
+            const uint16_t value = region >= 0 ? (uint16_t)region : NoRegion;
+            for (; c < m_cols && row[c] != Border; c++)
+            {
+                row[c] = value;
+            }
+        }
+    }
+}
+
+void MLaRasterRegionSet::markEdge(const Seiscomp::Geo::Vertex &a,
+                                  const Seiscomp::Geo::Vertex &b)
+{
+    // The bulge of a great circle segment, see MLaRegionIndex::boundingBox().
+    const double dLon = fabs((double)b.lon - (double)a.lon) * M_PI / 180.0;
+    const double margin = dLon * dLon / 8.0 * 180.0 / M_PI + RoundingMargin;
+    if (!isfinite(margin))
+    {
+        return;
+    }
+
+    // The edge as it is and moved by a turn, whatever contains() does with
+    // longitudes.
+    static const double shifts[] = { 0.0, 360.0, -360.0 };
+    for (int s = 0; s < 3; s++)
+    {
+        const double lat0 = a.lat, lon0 = a.lon + shifts[s];
+        const double lat1 = b.lat, lon1 = b.lon + shifts[s];
+        if (std::min(lon0, lon1) - margin > m_raster.lonMax ||
+            std::max(lon0, lon1) + margin < m_raster.lonMin)
+        {
+            continue;
+        }
+
+        const double first = floor((std::min(lat0, lat1) - margin - m_raster.latMin) * m_scale);
+        const double last = floor((std::max(lat0, lat1) + margin - m_raster.latMin) * m_scale);
+        const int r0 = (int)std::min((double)m_rows, std::max(0.0, first));
+        const int r1 = (int)std::max(-1.0, std::min((double)m_rows - 1, last));
+        for (int r = r0; r <= r1; r++)
+        {
+            // The part of the edge in the latitudes of the row widened by
+            // the margin, and its longitudes widened by the margin again.
+            const double bottom = m_raster.latMin + r * m_raster.resolution - margin;
+            const double top = m_raster.latMin + (r + 1) * m_raster.resolution + margin;
+            double west, east;
+            if (lat0 == lat1)
+            {
+                west = std::min(lon0, lon1);
+                east = std::max(lon0, lon1);
+            }
+            else
+            {
+                double t0 = (bottom - lat0) / (lat1 - lat0);
+                double t1 = (top - lat0) / (lat1 - lat0);
+                if (t0 > t1)
+                {
+                    std::swap(t0, t1);
+                }
+                t0 = std::max(0.0, t0);
+                t1 = std::min(1.0, t1);
+                if (t0 > t1)
+                {
+                    continue;
+                }
+                west = lon0 + t0 * (lon1 - lon0);
+                east = lon0 + t1 * (lon1 - lon0);
+                if (west > east)
+                {
+                    std::swap(west, east);
+                }
+            }
+
+            const int c0 = (int)std::min((double)m_cols,
+                std::max(0.0, floor((west - margin - m_raster.lonMin) * m_scale)));
+            const int c1 = (int)std::max(-1.0,
+                std::min((double)m_cols - 1, floor((east + margin - m_raster.lonMin) * m_scale)));
+            uint16_t *row = &m_built[(size_t)r * m_cols];
+            for (int c = c0; c <= c1; c++)
+            {
+                row[c] = Border;
+            }
+        }
+    }
+}
+
+bool MLaRasterRegionSet::write(const std::string &file, std::string &error) const
+{
+    const size_t count = (size_t)m_rows * m_cols;
+
+    MLaRasterHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MLaRasterMagic, sizeof(MLaRasterMagic));
+    header.version = MLaRasterVersion;
+    header.byteOrder = MLaCompiledByteOrder;
+    header.rows = m_rows;
+    header.cols = m_cols;
+    header.regionCount = m_regions->size();
+    header.borderCells = m_borderCells;
+    header.latMin = m_raster.latMin;
+    header.latMax = m_raster.latMax;
+    header.lonMin = m_raster.lonMin;
+    header.lonMax = m_raster.lonMax;
+    header.resolution = m_raster.resolution;
+    header.sourceMtime = version().mtime;
+    header.sourceSize = version().size;
+    header.checksum = checksum(m_cells, count);
+
+    // Several processes may build the raster at once.
+    std::ostringstream temporary;
+    temporary << file << ".tmp." << getpid();
+    {
+        std::ofstream out(temporary.str().c_str(), std::ios::binary | std::ios::trunc);
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)m_cells, count * sizeof(uint16_t));
+        out.close();
+        if (!out)
+        {
+            unlink(temporary.str().c_str());
+            error = "can not write " + temporary.str();
+            return false;
+        }
+    }
+
+    if (rename(temporary.str().c_str(), file.c_str()) != 0)
+    {
+        error = "can not rename " + temporary.str() + ": " + strerror(errno);
+        unlink(temporary.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int MLaRasterRegionSet::find(const Seiscomp::Geo::Vertex &location) const
+{
+    const double r = (location.lat - m_raster.latMin) * m_scale;
+    const double c = (location.lon - m_raster.lonMin) * m_scale;
+    if (r >= 0 && r < m_rows && c >= 0 && c < m_cols)
+    {
+        const uint16_t value = m_cells[(size_t)r * m_cols + (size_t)c];
+        if (value < NoRegion)
+        {
+            return value;
+        }
+        if (value == NoRegion)
+        {
+            return -1;
+        }
+    }
+
+    return m_regions->find(location);
+}
+
+void MLaRasterRegionSet::polygons(size_t region, Polygons &polygons) const
+{
+    m_regions->polygons(region, polygons);
+}
@@ -0,0 +1,152 @@
+/*
+ * File:   regionraster.h
+ */
+
+#ifndef __MLA_REGIONRASTER_H__
+#define __MLA_REGIONRASTER_H__
+
+#include "regionstore.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// Appended to the path of a region file to get the path of its cached raster.
+const char * const MLaRasterSuffix = ".raster";
+
+/*
+Layout of a cached raster file, in the byte order of the machine which wrote
+it like a compiled region file:
+
+    MLaRasterHeader
+    uint16_t            cells[rows * cols]      row by row, from the south
+                                                west corner
+
+The checksum covers the cells.
+*/
+struct MLaRasterHeader
+{
+    char        magic[8];       // MLaRasterMagic
+    uint32_t    version;        // MLaRasterVersion
+    uint32_t    byteOrder;      // MLaCompiledByteOrder
+    uint32_t    rows;
+    uint32_t    cols;
+    uint32_t    regionCount;
+    uint32_t    borderCells;
+    // The raster as configured.
+    double      latMin, latMax;
+    double      lonMin, lonMax;
+    double      resolution;
+    // Version of the region file which was rasterised, see MLaFileVersion.
+    int64_t     sourceMtime;    // nanoseconds
+    uint64_t    sourceSize;
+    // FNV-1a over the cells, 64 bits at a time.
+    uint64_t    checksum;
+};
+
+const char MLaRasterMagic[8] = { 'M', 'L', 'A', 'R', 'A', 'S', 'T', '\0' };
+const uint32_t MLaRasterVersion = 2;
+
+/*
+A region set with a raster over a fixed box in front of it. Every cell of the
+raster holds the region containing all of the cell, no region, or a marker
+that a region border runs through the cell. Locations in the first two kinds
+of cells are resolved by a single array read, only locations in border cells
+and outside of the box are passed on to the exact lookup of the region set.
+
+A cell is a border cell if it comes closer to any polygon edge than the edge
+may deviate from its chord in the lat/lon plane: by a great circle bulge,
+like the boxes of MLaRegionIndex, and by rounding of the single precision
+vertices and locations. No edge comes close to the other cells, so the exact
+lookup gives the same region anywhere in a run of them within a row, and it
+is asked once per run when the raster is built. Results are therefore the
+same as those of the exact lookup.
+
+The raster is written next to the region file and mapped from there again as
+long as the region file and the raster parameters do not change.
+*/
+class MLaRasterRegionSet : public MLaRegionSet
+{
+    public:
+
+        // Cell values other than region positions.
+        static const uint16_t NoRegion = 0xFFFE;
+        static const uint16_t Border = 0xFFFF;
+
+        // Largest number of cells of a raster, 256 MB.
+        static const size_t MaxCells = 1 << 27;
+
+        ~MLaRasterRegionSet();
+
+        /*
+        Puts a raster in front of a region set, mapping the cached raster if
+        it matches and building and caching it otherwise.
+
+        @param regions: The region set to rasterise.
+        @param raster: Box and cell size of the raster.
+        @param file: Path of the cached raster.
+        @param error: Set to the reason if there is no raster, or if a
+                      raster was built but could not be cached.
+        @returns The region set or an empty pointer.
+        */
+        static std::shared_ptr<MLaRasterRegionSet> create(
+            const MLaRegionSetPtr &regions, const MLaRasterSpec &raster,
+            const std::string &file, std::string &error
+        );
+
+        // Returns the region set the raster was built from.
+        const MLaRegionSetPtr &regions() const { return m_regions; }
+
+        // Returns the number of rows and columns of the raster.
+        uint32_t rows() const { return m_rows; }
+        uint32_t cols() const { return m_cols; }
+
+        // Returns the number of border cells.
+        size_t borderCells() const { return m_borderCells; }
+
+        // Returns the memory taken by the cells in bytes.
+        size_t memory() const { return (size_t)m_rows * m_cols * sizeof(uint16_t); }
+
+        // Returns the seconds it took to build or map the raster.
+        double seconds() const { return m_seconds; }
+
+        // Returns whether the raster was mapped from the cached file.
+        bool cached() const { return m_mapping != NULL; }
+
+        size_t size() const { return m_regions->size(); }
+        const std::string &name(size_t region) const { return m_regions->name(region); }
+        int find(const Seiscomp::Geo::Vertex &location) const;
+        void polygons(size_t region, Polygons &polygons) const;
+
+    private:
+
+        MLaRasterRegionSet(const MLaRegionSetPtr &regions, const MLaRasterSpec &raster);
+
+        // Maps a cached raster, returns false if it does not match.
+        bool open(const std::string &file, std::string &error);
+
+        // Builds the raster from the polygons of the regions.
+        void build();
+
+        // Marks the cells close to the edge from a to b as border cells.
+        void markEdge(const Seiscomp::Geo::Vertex &a, const Seiscomp::Geo::Vertex &b);
+
+        // Writes the raster under a temporary name and renames it to file.
+        bool write(const std::string &file, std::string &error) const;
+
+        MLaRegionSetPtr              m_regions;
+        MLaRasterSpec                m_raster;
+        uint32_t                     m_rows;
+        uint32_t                     m_cols;
+        double                       m_scale;      // cells per degree
+        const uint16_t              *m_cells;
+        std::vector<uint16_t>        m_built;
+        void                        *m_mapping;
+        size_t                       m_mappingSize;
+        size_t                       m_borderCells;
+        double                       m_seconds;
+};
+
+#endif /* __MLA_REGIONRASTER_H__ */
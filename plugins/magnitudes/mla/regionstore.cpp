@@ -0,0 +1,228 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "regionstore.h"
+#include "compiledregions.h"
+#include "filewatcher.h"
+#include "regionraster.h"
+
+#include <seiscomp/logging/log.h>
+
+#include <atomic>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+
+
+namespace {
+
+// Used by the watcher thread, which may still reload a file while the
+// process exits, so it is never destroyed.
+MLaFileCache<MLaRegionSet> &regionSets = *new MLaFileCache<MLaRegionSet>;
+
+// Serial of the last region set created.
+std::atomic<uint64_t> regionSetSerial(0);
+
+}
+
+MLaRegionSet::MLaRegionSet(const std::string &path, const MLaFileVersion &version)
+    : m_path(path), m_version(version),
+      m_serial(regionSetSerial.fetch_add(1, std::memory_order_relaxed) + 1)
+{
+}
+
+MLaRegionSet::~MLaRegionSet()
+{
+}
+
+MLaBNARegionSet::MLaBNARegionSet(const std::string &path, const MLaFileVersion &version)
+    : MLaRegionSet(path, version), m_category(1)
+{
+}
+
+size_t MLaBNARegionSet::size() const
+{
+    return m_features.features().size();
+}
+
+const std::string &MLaBNARegionSet::name(size_t region) const
+{
+    return m_features.features()[region]->name();
+}
+
+int MLaBNARegionSet::find(const Seiscomp::Geo::Vertex &location) const
+{
+    return m_index.find(location);
+}
+
+void MLaBNARegionSet::polygons(size_t region, Polygons &polygons) const
+{
+    const Seiscomp::Geo::GeoFeature *feature = m_features.features()[region];
+    const std::vector<Seiscomp::Geo::Vertex> &vertices = feature->vertices();
+
+    // All vertices as one polygon and, for features with sub features, each
+    // sub feature on its own as well: a superset of the edges whatever
+    // GeoFeature::contains() makes of sub features.
+    polygons.assign(1, vertices);
+    const std::vector<size_t> &starts = feature->subFeatures();
+    for (size_t i = 0; i < starts.size(); i++)
+    {
+        size_t begin = starts[i];
+        size_t end = i + 1 < starts.size() ? starts[i + 1] : vertices.size();
+        if (i == 0 && begin > 0)
+        {
+            polygons.push_back(std::vector<Seiscomp::Geo::Vertex>(
+                vertices.begin(), vertices.begin() + begin));
+        }
+        if (begin < end && end <= vertices.size())
+        {
+            polygons.push_back(std::vector<Seiscomp::Geo::Vertex>(
+                vertices.begin() + begin, vertices.begin() + end));
+        }
+    }
+}
+
+MLaRegionSetPtr MLaRegionStore::acquire(const std::string &filePath,
+                                        const MLaRasterSpec &raster)
+{
+    return acquire(filePath, raster, false);
+}
+
+MLaRegionSetPtr MLaRegionStore::acquire(const std::string &filePath,
+                                        const MLaRasterSpec &raster, bool reread)
+{
+    std::string path;
+    MLaFileVersion version;
+    if (!MLaFileStore::resolve(filePath, path, version))
+    {
+        SEISCOMP_ERROR("Can not access the bna region file at %s", filePath.c_str());
+        return MLaRegionSetPtr();
+    }
+
+    const std::string key = MLaFileStore::key(path, version);
+    MLaRegionSetPtr regions = regionSets.acquire(key, reread, [&]()
+    {
+        return load(path, version);
+    });
+    if (!regions)
+    {
+        SEISCOMP_ERROR("Can not read the bna region file at %s", path.c_str());
+        return MLaRegionSetPtr();
+    }
+
+    // Rasters are shared by processors asking for the same one, the regions
+    // beneath by all processors.
+    if (raster.enabled())
+    {
+        std::ostringstream rasterKey;
+        rasterKey.precision(17);
+        rasterKey << key << "#raster:" << raster.latMin << ',' << raster.latMax << ','
+                  << raster.lonMin << ',' << raster.lonMax << ',' << raster.resolution;
+
+        const MLaRegionSetPtr base = regions;
+        regions = regionSets.acquire(rasterKey.str(), reread, [&]()
+        {
+            return rasterise(base, raster);
+        });
+    }
+
+    SEISCOMP_INFO(
+        "MLa region file %s: %lu regions, shared by %ld instances",
+        path.c_str(),
+        (unsigned long)regions->size(),
+        (long)regions.use_count()
+    );
+
+    return regions;
+}
+
+MLaRegionSetPtr MLaRegionStore::load(const std::string &path, const MLaFileVersion &version)
+{
+    std::string error;
+
+    if (MLaCompiledRegionSet::isCompiled(path))
+    {
+        MLaRegionSetPtr regions = MLaCompiledRegionSet::open(path, path, version, error);
+        if (!regions)
+        {
+            SEISCOMP_ERROR("Can not use the compiled region file %s: %s",
+                           path.c_str(), error.c_str());
+        }
+        return regions;
+    }
+
+    // Prefer the compiled file of the current version of the bna file.
+    const std::string compiled = path + MLaCompiledRegionSuffix;
+    if (access(compiled.c_str(), F_OK) == 0)
+    {
+        std::shared_ptr<MLaCompiledRegionSet> regions =
+            MLaCompiledRegionSet::open(compiled, path, version, error);
+        if (regions && regions->header().sourceMtime == version.mtime &&
+            regions->header().sourceSize == version.size)
+        {
+            SEISCOMP_DEBUG("Loaded the compiled region file %s", compiled.c_str());
+            return regions;
+        }
+
+        SEISCOMP_WARNING("Ignoring the compiled region file %s: %s, reading %s",
+                         compiled.c_str(),
+                         regions ? "compiled from another version" : error.c_str(),
+                         path.c_str());
+    }
+
+    std::shared_ptr<MLaBNARegionSet> regions(new MLaBNARegionSet(path, version));
+    if (!regions->m_features.readBNAFile(path, &regions->m_category))
+    {
+        return MLaRegionSetPtr();
+    }
+
+    regions->m_index.build(regions->m_features);
+    return regions;
+}
+
+MLaRegionSetPtr MLaRegionStore::rasterise(const MLaRegionSetPtr &regions,
+                                           const MLaRasterSpec &raster)
+{
+    const std::string file = regions->path() + MLaRasterSuffix;
+    std::string error;
+    std::shared_ptr<MLaRasterRegionSet> rasterised =
+        MLaRasterRegionSet::create(regions, raster, file, error);
+    if (!rasterised)
+    {
+        SEISCOMP_WARNING("No region raster for %s, resolving every location exactly: %s",
+                         regions->path().c_str(), error.c_str());
+        return regions;
+    }
+    if (!error.empty())
+    {
+        SEISCOMP_WARNING("Can not cache the region raster in %s: %s",
+                         file.c_str(), error.c_str());
+    }
+
+    SEISCOMP_INFO(
+        "MLa region raster of %s: %ux%u cells of %g degrees, %.1f%% on region borders, "
+        "%.1f MB, %s in %.3f s",
+        regions->path().c_str(), rasterised->rows(), rasterised->cols(), raster.resolution,
+        100.0 * rasterised->borderCells() / ((double)rasterised->rows() * rasterised->cols()),
+        rasterised->memory() / 1048576.0,
+        rasterised->cached() ? "mapped" : "built",
+        rasterised->seconds()
+    );
+
+    return rasterised;
+}
+
+MLaRegionWatchPtr MLaRegionStore::watch(const std::string &filePath, double interval,
+                                        const MLaRasterSpec &raster)
+{
+    return MLaRegionWatch::watch(filePath, raster, interval,
+        [](const std::string &filePath, const MLaRasterSpec &raster, bool reread)
+        {
+            return acquire(filePath, raster, reread);
+        },
+        "region file");
+}
+
+void MLaRegionStore::requestReload()
+{
+    MLaFileWatcher::requestReload();
+}
@@ -0,0 +1,230 @@
+/*
+ * File:   regionstore.h
+ */
+
+#ifndef __MLA_REGIONSTORE_H__
+#define __MLA_REGIONSTORE_H__
+
+#include "filestore.h"
+#include "regionindex.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+The regions of one region file. A region set is immutable once it has been
+loaded, so it can be shared freely between processors.
+*/
+class MLaRegionSet
+{
+    public:
+
+        // The polygons of a region, each one a list of vertices.
+        typedef std::vector< std::vector<Seiscomp::Geo::Vertex> > Polygons;
+
+        virtual ~MLaRegionSet();
+
+        // Returns the canonical path of the configured region file.
+        const std::string &path() const { return m_path; }
+
+        // Returns the version of the region file which was read.
+        const MLaFileVersion &version() const { return m_version; }
+
+        // Returns a number identifying the region set among all region sets
+        // of the process, never 0.
+        uint64_t serial() const { return m_serial; }
+
+        // Returns the number of regions.
+        virtual size_t size() const = 0;
+
+        // Returns the name of a region, i.e. the zone it belongs to.
+        virtual const std::string &name(size_t region) const = 0;
+
+        /*
+        Returns the first region, in file order, which contains the given
+        location.
+
+        @param location: The location to look up.
+        @returns The position of the region or -1.
+        */
+        virtual int find(const Seiscomp::Geo::Vertex &location) const = 0;
+
+        /*
+        Returns the polygons of a region, which find() tests locations
+        against.
+
+        @param region: The position of the region.
+        @param polygons: Set to the polygons of the region.
+        */
+        virtual void polygons(size_t region, Polygons &polygons) const = 0;
+
+    protected:
+
+        MLaRegionSet(const std::string &path, const MLaFileVersion &version);
+
+    private:
+
+        std::string                         m_path;
+        MLaFileVersion                      m_version;
+        uint64_t                            m_serial;
+};
+
+/*
+The regions read from a bna file: the features, the category they were read
+with and the spatial index over them.
+*/
+class MLaBNARegionSet : public MLaRegionSet
+{
+    public:
+
+        // Returns the features read from the bna file.
+        const Seiscomp::Geo::GeoFeatureSet &features() const { return m_features; }
+
+        // Returns the spatial index over the features.
+        const MLaRegionIndex &index() const { return m_index; }
+
+        size_t size() const;
+        const std::string &name(size_t region) const;
+        int find(const Seiscomp::Geo::Vertex &location) const;
+        void polygons(size_t region, Polygons &polygons) const;
+
+    private:
+
+        friend class MLaRegionStore;
+
+        MLaBNARegionSet(const std::string &path, const MLaFileVersion &version);
+
+        // Declared before m_features, which refer to it.
+        Seiscomp::Geo::Category             m_category;
+        Seiscomp::Geo::GeoFeatureSet        m_features;
+        MLaRegionIndex                      m_index;
+};
+
+typedef std::shared_ptr<const MLaRegionSet> MLaRegionSetPtr;
+
+/*
+Box and cell size in degrees of a raster put in front of the regions of a
+file, see MLaRasterRegionSet. The default box covers Australia, a cell size
+of 0 means no raster.
+*/
+struct MLaRasterSpec
+{
+    MLaRasterSpec()
+        : latMin(-45), latMax(-9), lonMin(108), lonMax(156), resolution(0) {}
+
+    // Returns whether a raster is asked for.
+    bool enabled() const { return resolution > 0; }
+
+    bool operator==(const MLaRasterSpec &other) const
+    {
+        return latMin == other.latMin && latMax == other.latMax &&
+               lonMin == other.lonMin && lonMax == other.lonMax &&
+               resolution == other.resolution;
+    }
+
+    double  latMin, latMax;
+    double  lonMin, lonMax;
+    double  resolution;
+};
+
+// A bna file watched for changes, see MLaFileWatch. The spec is the raster put
+// in front of the regions.
+typedef MLaFileWatch<MLaRegionSet, MLaRasterSpec> MLaRegionWatch;
+typedef std::shared_ptr<MLaRegionWatch> MLaRegionWatchPtr;
+
+/*
+Process wide store of region sets. Every processor configured with the same
+bna file gets a handle to the same region set, so the file is parsed and
+indexed once per process instead of once per processor (i.e. once per station
+binding in scmag). Region sets are keyed by the canonical path and the
+version of the file (see MLaFileVersion): a file which changed on disk is
+read again the next time a processor is set up. A region set is released as soon as
+the last processor holding it is gone.
+
+If a compiled region file (see MLaCompiledRegionSet) of the current version
+of the bna file exists next to it, it is loaded instead of parsing the bna
+file. The configured path may also name a compiled region file directly.
+
+Processors may ask for a raster in front of the regions (see
+MLaRasterRegionSet), which is shared the same way by all processors asking
+for the same raster of a file.
+*/
+class MLaRegionStore
+{
+    public:
+
+        /*
+        Returns the region set for a bna file, reading the file if no region
+        set for its current version is held by any processor.
+
+        @param filePath: Path of the bna file.
+        @param raster: The raster to put in front of the regions. If it can
+                       not be built, the regions are used without it.
+        @returns The region set or an empty pointer if the file could not be
+                 read.
+        */
+        static MLaRegionSetPtr acquire(const std::string &filePath,
+                                       const MLaRasterSpec &raster = MLaRasterSpec());
+
+        /*
+        Returns a watch on a bna file, which is checked for changes every
+        interval seconds by a background thread until the last holder of
+        the watch releases it. All processors configured with the same path
+        and raster share one watch, the interval of the first one applies.
+
+        @param filePath: Path of the bna file.
+        @param interval: Seconds between two checks.
+        @param raster: The raster to put in front of the regions.
+        @returns The watch or an empty pointer if the file could not be
+                 read.
+        */
+        static MLaRegionWatchPtr watch(const std::string &filePath, double interval,
+                                       const MLaRasterSpec &raster = MLaRasterSpec());
+
+        /*
+        Asks the watcher thread (see MLaFileWatcher) to read all watched
+        files again right away, whether they changed or not.
+        */
+        static void requestReload();
+
+    private:
+
+        MLaRegionStore();
+
+        /*
+        Returns the region set for a bna file.
+
+        @param filePath: Path of the bna file.
+        @param raster: The raster to put in front of the regions.
+        @param reread: Whether to read the file even if a region set of its
+                       current version is held already.
+        */
+        static MLaRegionSetPtr acquire(const std::string &filePath,
+                                       const MLaRasterSpec &raster, bool reread);
+
+        /*
+        Loads a region file, from a compiled file if there is a usable
+        one.
+
+        @param path: Canonical path of the region file.
+        @param version: Version of the region file.
+        @returns The region set or an empty pointer.
+        */
+        static MLaRegionSetPtr load(const std::string &path, const MLaFileVersion &version);
+
+        /*
+        Puts a raster in front of a region set, caching it next to the
+        region file.
+
+        @param regions: The region set.
+        @param raster: The raster to put in front of it.
+        @returns The region set with the raster, or the region set itself if
+                 the raster can not be built.
+        */
+        static MLaRegionSetPtr rasterise(const MLaRegionSetPtr &regions,
+                                         const MLaRasterSpec &raster);
+};
+
+#endif /* __MLA_REGIONSTORE_H__ */
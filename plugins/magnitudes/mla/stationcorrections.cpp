@@ -0,0 +1,291 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "stationcorrections.h"
+
+#include <seiscomp/logging/log.h>
+
+#include <fstream>
+#include <sstream>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+namespace {
+
+// Used by the watcher thread, never destroyed like the region sets.
+MLaFileCache<MLaStationCorrections> &correctionSets =
+    *new MLaFileCache<MLaStationCorrections>;
+
+const uint64_t FNVOffset = 14695981039346656037ull;
+const uint64_t FNVPrime = 1099511628211ull;
+
+inline uint64_t fnv(uint64_t hash, const std::string &text)
+{
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        hash = (hash ^ (unsigned char)text[i]) * FNVPrime;
+    }
+    return hash;
+}
+
+struct Entry
+{
+    std::string network;
+    std::string station;
+    std::string location;
+    double      correction;
+};
+
+/*
+Parses a line of a station correction file.
+
+@returns false if the line is malformed, true otherwise. entry.network is
+         left empty for blank and comment lines.
+*/
+bool parse(const std::string &line, Entry &entry)
+{
+    std::string content = line.substr(0, line.find('#'));
+    std::istringstream tokens(content);
+    std::string code, value, extra;
+    if (!(tokens >> code))
+    {
+        return true;
+    }
+    if (!(tokens >> value) || (tokens >> extra))
+    {
+        return false;
+    }
+
+    size_t first = code.find('.');
+    if (first == std::string::npos || first == 0)
+    {
+        return false;
+    }
+    size_t second = code.find('.', first + 1);
+    entry.network = code.substr(0, first);
+    if (second == std::string::npos)
+    {
+        entry.station = code.substr(first + 1);
+        entry.location.clear();
+    }
+    else
+    {
+        entry.station = code.substr(first + 1, second - first - 1);
+        entry.location = code.substr(second + 1);
+        if (entry.location.find('.') != std::string::npos)
+        {
+            return false;
+        }
+    }
+    if (entry.station.empty())
+    {
+        return false;
+    }
+
+    char *end;
+    entry.correction = strtod(value.c_str(), &end);
+    return *end == '\0' && isfinite(entry.correction);
+}
+
+}
+
+MLaStationCorrections::MLaStationCorrections(const std::string &path,
+                                             const MLaFileVersion &version)
+    : m_path(path), m_version(version), m_mask(0), m_size(0)
+{
+}
+
+MLaStationCorrectionsPtr MLaStationCorrections::read(
+    const std::string &path, const MLaFileVersion &version, std::string &error)
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+    {
+        error = "can not open the file";
+        return MLaStationCorrectionsPtr();
+    }
+
+    std::vector<Entry> entries;
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); number++)
+    {
+        Entry entry;
+        if (!parse(line, entry))
+        {
+            std::ostringstream message;
+            message << "line " << number << " is not NET.STA.LOC CORRECTION";
+            error = message.str();
+            return MLaStationCorrectionsPtr();
+        }
+        if (entry.network.empty())
+        {
+            continue;
+        }
+        if (entries.size() >= MaxStations)
+        {
+            error = "too many stations";
+            return MLaStationCorrectionsPtr();
+        }
+        entries.push_back(entry);
+    }
+    if (file.bad())
+    {
+        error = "can not read the file";
+        return MLaStationCorrectionsPtr();
+    }
+
+    std::shared_ptr<MLaStationCorrections> corrections(new MLaStationCorrections(path, version));
+    corrections->reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const Entry &entry = entries[i];
+        if (!corrections->add(entry.network, entry.station, entry.location, entry.correction))
+        {
+            error = entry.network + "." + entry.station + "." + entry.location +
+                    " is listed more than once";
+            return MLaStationCorrectionsPtr();
+        }
+    }
+
+    return corrections;
+}
+
+uint64_t MLaStationCorrections::hash(const std::string &network, const std::string &station,
+                                     const std::string &location)
+{
+    uint64_t h = fnv(FNVOffset, network);
+    h = (h ^ '.') * FNVPrime;
+    h = fnv(h, station);
+    h = (h ^ '.') * FNVPrime;
+    return fnv(h, location);
+}
+
+bool MLaStationCorrections::matches(const Slot &slot, const std::string &network,
+                                    const std::string &station, const std::string &location) const
+{
+    if (slot.length != network.size() + station.size() + location.size() + 2)
+    {
+        return false;
+    }
+
+    const char *key = m_keys.data() + slot.key;
+    if (memcmp(key, network.data(), network.size()) != 0 || key[network.size()] != '.')
+    {
+        return false;
+    }
+    key += network.size() + 1;
+    if (memcmp(key, station.data(), station.size()) != 0 || key[station.size()] != '.')
+    {
+        return false;
+    }
+    key += station.size() + 1;
+    return memcmp(key, location.data(), location.size()) == 0;
+}
+
+void MLaStationCorrections::reserve(size_t stations)
+{
+    size_t capacity = 16;
+    while (capacity < 2 * stations)
+    {
+        capacity *= 2;
+    }
+
+    Slot empty = { 0, 0, 0, 0 };
+    m_slots.assign(capacity, empty);
+    m_mask = capacity - 1;
+}
+
+bool MLaStationCorrections::add(const std::string &network, const std::string &station,
+                                const std::string &location, double correction)
+{
+    const uint64_t h = hash(network, station, location);
+    size_t index = (size_t)(h ^ (h >> 32)) & m_mask;
+    while (m_slots[index].length != 0)
+    {
+        if (m_slots[index].hash == h && matches(m_slots[index], network, station, location))
+        {
+            return false;
+        }
+        index = (index + 1) & m_mask;
+    }
+
+    Slot &slot = m_slots[index];
+    slot.hash = h;
+    slot.key = (uint32_t)m_keys.size();
+    slot.length = (uint32_t)(network.size() + station.size() + location.size() + 2);
+    slot.correction = correction;
+    m_keys += network + "." + station + "." + location;
+    m_size++;
+    return true;
+}
+
+bool MLaStationCorrections::find(const std::string &network, const std::string &station,
+                                 const std::string &location, double &correction) const
+{
+    if (m_size == 0)
+    {
+        return false;
+    }
+
+    const uint64_t h = hash(network, station, location);
+    size_t index = (size_t)(h ^ (h >> 32)) & m_mask;
+    for (;;)
+    {
+        const Slot &slot = m_slots[index];
+        if (slot.length == 0)
+        {
+            return false;
+        }
+        if (slot.hash == h && matches(slot, network, station, location))
+        {
+            correction = slot.correction;
+            return true;
+        }
+        index = (index + 1) & m_mask;
+    }
+}
+
+MLaStationCorrectionsPtr MLaStationCorrectionStore::acquire(const std::string &filePath)
+{
+    return acquire(filePath, false);
+}
+
+MLaStationCorrectionsPtr MLaStationCorrectionStore::acquire(const std::string &filePath, bool reread)
+{
+    std::string path;
+    MLaFileVersion version;
+    if (!MLaFileStore::resolve(filePath, path, version))
+    {
+        SEISCOMP_ERROR("Can not access the station correction file at %s", filePath.c_str());
+        return MLaStationCorrectionsPtr();
+    }
+
+    return correctionSets.acquire(MLaFileStore::key(path, version), reread, [&]()
+    {
+        std::string error;
+        MLaStationCorrectionsPtr corrections = MLaStationCorrections::read(path, version, error);
+        if (!corrections)
+        {
+            SEISCOMP_ERROR("Can not read the station correction file %s: %s",
+                           path.c_str(), error.c_str());
+            return corrections;
+        }
+
+        SEISCOMP_INFO(
+            "MLa station correction file %s: %lu stations",
+            path.c_str(), (unsigned long)corrections->size()
+        );
+        return corrections;
+    });
+}
+
+MLaStationCorrectionWatchPtr MLaStationCorrectionStore::watch(const std::string &filePath, double interval)
+{
+    return MLaStationCorrectionWatch::watch(filePath, MLaNoSpec(), interval,
+        [](const std::string &filePath, const MLaNoSpec &, bool reread)
+        {
+            return acquire(filePath, reread);
+        },
+        "station correction file");
+}
@@ -0,0 +1,155 @@
+/*
+ * File:   stationcorrections.h
+ */
+
+#ifndef __MLA_STATIONCORRECTIONS_H__
+#define __MLA_STATIONCORRECTIONS_H__
+
+#include "filestore.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/*
+Additive MLa corrections of stations, keyed by network, station and
+location code, read from a station correction file. The file holds one
+station per line, its NET.STA.LOC code and the correction, separated by
+blanks:
+
+    # Comments start with a hash.
+    AU.ARMA.    -0.05
+    AU.CMSA.00   0.12
+
+An empty location code may be written as NET.STA or NET.STA. as well.
+
+The corrections are kept in an open addressing hash table with linear
+probing, at most half full, whose keys are stored one after the other in a
+single string. A lookup hashes the three codes as they are, without
+building the key, and usually compares a single slot. The table is
+immutable once read, so it can be shared freely between processors.
+*/
+class MLaStationCorrections
+{
+    public:
+
+        // Largest number of stations of a file.
+        static const size_t MaxStations = 1 << 20;
+
+        /*
+        Reads a station correction file.
+
+        @param path: Canonical path of the file.
+        @param version: Version of the file.
+        @param error: Receives the reason if the file can not be used.
+        @returns The corrections or an empty pointer.
+        */
+        static std::shared_ptr<const MLaStationCorrections> read(
+            const std::string &path, const MLaFileVersion &version, std::string &error);
+
+        // Returns the canonical path of the file.
+        const std::string &path() const { return m_path; }
+
+        // Returns the version of the file which was read.
+        const MLaFileVersion &version() const { return m_version; }
+
+        // Returns the number of stations.
+        size_t size() const { return m_size; }
+
+        /*
+        Looks up the correction of a station.
+
+        @param network: The network code.
+        @param station: The station code.
+        @param location: The location code.
+        @param correction: Receives the correction if there is one.
+        @returns Whether there is a correction for the station.
+        */
+        bool find(const std::string &network, const std::string &station,
+                  const std::string &location, double &correction) const;
+
+    private:
+
+        struct Slot
+        {
+            uint64_t    hash;
+            uint32_t    key;        // offset of the key in m_keys
+            uint32_t    length;     // of the key, 0 for an empty slot
+            double      correction;
+        };
+
+        MLaStationCorrections(const std::string &path, const MLaFileVersion &version);
+
+        // Hashes NET.STA.LOC (64 bit FNV-1a).
+        static uint64_t hash(const std::string &network, const std::string &station,
+                             const std::string &location);
+
+        // Whether the key of a slot is NET.STA.LOC.
+        bool matches(const Slot &slot, const std::string &network,
+                     const std::string &station, const std::string &location) const;
+
+        // Adds a station, returns false if it is there already.
+        bool add(const std::string &network, const std::string &station,
+                 const std::string &location, double correction);
+
+        // Sizes the table for a number of stations.
+        void reserve(size_t stations);
+
+        std::string                 m_path;
+        MLaFileVersion              m_version;
+        std::vector<Slot>           m_slots;
+        size_t                      m_mask;
+        std::string                 m_keys;
+        size_t                      m_size;
+};
+
+typedef std::shared_ptr<const MLaStationCorrections> MLaStationCorrectionsPtr;
+
+// A station correction file watched for changes, see MLaFileWatch.
+typedef MLaFileWatch<MLaStationCorrections, MLaNoSpec> MLaStationCorrectionWatch;
+typedef std::shared_ptr<MLaStationCorrectionWatch> MLaStationCorrectionWatchPtr;
+
+/*
+Process wide store of station corrections, the counterpart of
+MLaRegionStore: every processor configured with the same file shares one
+table, which is read again when the file changed on disk.
+*/
+class MLaStationCorrectionStore
+{
+    public:
+
+        /*
+        Returns the corrections of a file, reading the file if no
+        processor holds the corrections of its current version.
+
+        @param filePath: Path of the station correction file.
+        @returns The corrections or an empty pointer if the file could not
+                 be read.
+        */
+        static MLaStationCorrectionsPtr acquire(const std::string &filePath);
+
+        /*
+        Returns a watch on a station correction file, which is checked for
+        changes every interval seconds until the last holder of the watch
+        releases it. All processors configured with the same path share one
+        watch, the interval of the first one applies.
+
+        @param filePath: Path of the station correction file.
+        @param interval: Seconds between two checks.
+        @returns The watch or an empty pointer if the file could not be
+                 read.
+        */
+        static MLaStationCorrectionWatchPtr watch(const std::string &filePath, double interval);
+
+    private:
+
+        MLaStationCorrectionStore();
+
+        // Returns the corrections of a file, reading it again if reread is
+        // set.
+        static MLaStationCorrectionsPtr acquire(const std::string &filePath, bool reread);
+};
+
+#endif /* __MLA_STATIONCORRECTIONS_H__ */
@@ -0,0 +1,237 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "statistics.h"
+#include "bufferpool.h"
+
+#include <seiscomp/logging/log.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <stdio.h>
+
+
+namespace {
+
+std::mutex registryMutex;
+std::string zoneNames[MLaStatistics::MaxZones];
+std::atomic<int> zoneCount(0);
+
+// Dump interval, guarded by dumpMutex like the state of the dump thread.
+std::mutex dumpMutex;
+std::condition_variable dumpWake;
+std::chrono::nanoseconds dumpInterval(0);
+bool dumpStop = false;
+
+// Formats a bucket bound (in nanoseconds) for humans.
+std::string formatBound(uint64_t nanoseconds)
+{
+    char buffer[32];
+    if (nanoseconds < 1000)
+    {
+        snprintf(buffer, sizeof(buffer), "%luns", (unsigned long)nanoseconds);
+    }
+    else if (nanoseconds < 1000000)
+    {
+        snprintf(buffer, sizeof(buffer), "%.1fus", nanoseconds * 1E-3);
+    }
+    else
+    {
+        snprintf(buffer, sizeof(buffer), "%.1fms", nanoseconds * 1E-6);
+    }
+    return buffer;
+}
+
+}
+
+MLaLatencyHistogram::MLaLatencyHistogram()
+    : m_count(0), m_total(0)
+{
+    for (int i = 0; i < Buckets; i++)
+    {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void MLaLatencyHistogram::record(uint64_t nanoseconds)
+{
+    int bucket = nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    if (bucket >= Buckets)
+    {
+        bucket = Buckets - 1;
+    }
+
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_total.fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+std::string MLaLatencyHistogram::summary() const
+{
+    // Snapshot the buckets, the count is taken from them so that the
+    // percentiles are consistent.
+    uint64_t buckets[Buckets];
+    uint64_t count = 0;
+    for (int i = 0; i < Buckets; i++)
+    {
+        buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        count += buckets[i];
+    }
+    uint64_t total = m_total.load(std::memory_order_relaxed);
+
+    if (count == 0)
+    {
+        return "n=0";
+    }
+
+    std::string p50, p99;
+    uint64_t seen = 0;
+    for (int i = 0; i < Buckets; i++)
+    {
+        seen += buckets[i];
+        if (p50.empty() && seen * 2 >= count)
+        {
+            p50 = formatBound((uint64_t)1 << (i + 1));
+        }
+        if (p99.empty() && seen * 100 >= count * 99)
+        {
+            p99 = formatBound((uint64_t)1 << (i + 1));
+        }
+    }
+
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "n=%lu mean=%s p50<%s p99<%s",
+             (unsigned long)count, formatBound(total / count).c_str(),
+             p50.c_str(), p99.c_str());
+    return buffer;
+}
+
+std::atomic<bool> MLaStatistics::s_enabled(false);
+MLaLatencyHistogram MLaStatistics::amplitudes;
+MLaLatencyHistogram MLaStatistics::regionResolutions;
+MLaLatencyHistogram MLaStatistics::zoneFormulas[MLaStatistics::MaxZones];
+std::atomic<uint64_t> MLaStatistics::zoneBatched[MLaStatistics::MaxZones];
+std::atomic<uint64_t> MLaStatistics::amplitudeFailures(0);
+std::atomic<uint64_t> MLaStatistics::outOfRegion(0);
+std::atomic<uint64_t> MLaStatistics::regionCacheHits(0);
+std::atomic<uint64_t> MLaStatistics::regionCacheMisses(0);
+
+namespace {
+
+// Stops the dump thread and logs the statistics a last time when the
+// process exits. Defined after the statistics so that it is destroyed
+// before them.
+struct DumpThread
+{
+    ~DumpThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(dumpMutex);
+            dumpStop = true;
+        }
+        dumpWake.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+            MLaStatistics::dump();
+        }
+    }
+
+    std::thread thread;
+};
+
+DumpThread dumpThread;
+
+}
+
+void MLaStatistics::configure(double interval)
+{
+    if (!(interval > 0))
+    {
+        return;
+    }
+
+    std::chrono::nanoseconds nanoseconds((int64_t)(interval * 1E9));
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        if (nanoseconds <= dumpInterval)
+        {
+            return;
+        }
+        dumpInterval = nanoseconds;
+        s_enabled.store(true, std::memory_order_relaxed);
+        if (!dumpThread.thread.joinable())
+        {
+            dumpThread.thread = std::thread(loop);
+        }
+    }
+    dumpWake.notify_all();
+}
+
+int MLaStatistics::zone(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    int count = zoneCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; i++)
+    {
+        if (zoneNames[i] == name)
+        {
+            return i;
+        }
+    }
+
+    if (count == MaxZones)
+    {
+        return -1;
+    }
+
+    zoneNames[count] = name;
+    zoneBatched[count].store(0, std::memory_order_relaxed);
+    zoneCount.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+void MLaStatistics::loop()
+{
+    std::unique_lock<std::mutex> lock(dumpMutex);
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    while (!dumpStop)
+    {
+        // Waits again if a longer interval was configured meanwhile.
+        if (std::chrono::steady_clock::now() < last + dumpInterval)
+        {
+            dumpWake.wait_until(lock, last + dumpInterval);
+            continue;
+        }
+
+        lock.unlock();
+        dump();
+        lock.lock();
+        last = std::chrono::steady_clock::now();
+    }
+}
+
+void MLaStatistics::dump()
+{
+    SEISCOMP_INFO("MLa statistics: amplitudes %s, failed %lu",
+                  amplitudes.summary().c_str(),
+                  (unsigned long)amplitudeFailures.load(std::memory_order_relaxed));
+    SEISCOMP_INFO("MLa statistics: data buffers reused %lu, allocated %lu",
+                  (unsigned long)MLaBufferPool::reuses(),
+                  (unsigned long)MLaBufferPool::allocations());
+    SEISCOMP_INFO("MLa statistics: region resolutions %s, out of region %lu, "
+                  "cache hits %lu, misses %lu",
+                  regionResolutions.summary().c_str(),
+                  (unsigned long)outOfRegion.load(std::memory_order_relaxed),
+                  (unsigned long)regionCacheHits.load(std::memory_order_relaxed),
+                  (unsigned long)regionCacheMisses.load(std::memory_order_relaxed));
+
+    int count = zoneCount.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+    {
+        SEISCOMP_INFO("MLa statistics: zone %s formula %s, batched %lu",
+                      zoneNames[i].c_str(), zoneFormulas[i].summary().c_str(),
+                      (unsigned long)zoneBatched[i].load(std::memory_order_relaxed));
+    }
+}
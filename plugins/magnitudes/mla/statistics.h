@@ -0,0 +1,159 @@
+/*
+ * File:   statistics.h
+ */
+
+#ifndef __MLA_STATISTICS_H__
+#define __MLA_STATISTICS_H__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <stdint.h>
+
+/*
+Latency histogram with power of two buckets: bucket k counts durations of
+[2^k, 2^(k+1)) nanoseconds, the last bucket everything longer. Recording is
+lock free and can be done from any thread.
+*/
+class MLaLatencyHistogram
+{
+    public:
+
+        static const int Buckets = 32;
+
+        MLaLatencyHistogram();
+
+        // Records a duration (in nanoseconds).
+        void record(uint64_t nanoseconds);
+
+        // Returns the number of durations recorded.
+        uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+
+        /*
+        Returns a one line summary: count, mean and the bucket bounds of the
+        median and the 99th percentile.
+        */
+        std::string summary() const;
+
+    private:
+
+        std::atomic<uint64_t> m_buckets[Buckets];
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_total;
+};
+
+/*
+Per process counters and latency histograms of the MLa processors. Disabled
+by default, mla.statisticsInterval enables them and sets how often they are
+logged. The setting applies to the whole process: any binding setting it
+enables the statistics, and the longest interval configured by any binding
+wins, a binding can neither disable them nor shorten the interval. They are
+logged by a thread of their own, never by a computation, and a last time
+when the process exits.
+*/
+class MLaStatistics
+{
+    public:
+
+        // Maximum number of zones with their own formula statistics.
+        static const int MaxZones = 32;
+
+        /*
+        Enables the statistics or lengthens the interval between two dumps.
+        This is all it can do: statistics once enabled stay enabled until
+        the process exits, and shorter intervals than the current one are
+        ignored, so that the order processors are set up in does not matter.
+
+        @param interval: Seconds between two dumps to the log, 0 leaves the
+                         statistics as they are.
+        */
+        static void configure(double interval);
+
+        // Returns whether statistics are recorded.
+        static bool enabled()
+        {
+            return s_enabled.load(std::memory_order_relaxed);
+        }
+
+        /*
+        Returns the statistics slot of a zone, registering it if need be.
+
+        @param name: The zone name.
+        @returns The slot or -1 if MaxZones zones have been registered.
+        */
+        static int zone(const std::string &name);
+
+        // Latencies of Amplitude_MLA::computeAmplitude.
+        static MLaLatencyHistogram amplitudes;
+
+        // Latencies of the region resolution of Magnitude_MLA.
+        static MLaLatencyHistogram regionResolutions;
+
+        // Latencies of the formula of each zone slot.
+        static MLaLatencyHistogram zoneFormulas[MaxZones];
+
+        // Station magnitudes computed in batches per zone slot.
+        static std::atomic<uint64_t> zoneBatched[MaxZones];
+
+        // Amplitudes the MLv computation failed for.
+        static std::atomic<uint64_t> amplitudeFailures;
+
+        // Station magnitudes rejected with DistanceOutOfRange because the
+        // origin is not within any configured zone.
+        static std::atomic<uint64_t> outOfRegion;
+
+        // Region resolutions answered by the region cache and resolutions
+        // which had to query the regions.
+        static std::atomic<uint64_t> regionCacheHits;
+        static std::atomic<uint64_t> regionCacheMisses;
+
+        // Logs the statistics.
+        static void dump();
+
+    private:
+
+        MLaStatistics();
+
+        // The thread logging the statistics at the configured interval.
+        static void loop();
+
+        static std::atomic<bool> s_enabled;
+};
+
+/*
+Measures the time from its construction to stop(), if the statistics are
+enabled.
+*/
+class MLaStopwatch
+{
+    public:
+
+        MLaStopwatch() : m_running(MLaStatistics::enabled())
+        {
+            if (m_running)
+            {
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+
+        // Records the elapsed time in a histogram.
+        void stop(MLaLatencyHistogram &histogram)
+        {
+            if (!m_running)
+            {
+                return;
+            }
+
+            m_running = false;
+            histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - m_start).count());
+        }
+
+    private:
+
+        bool                                  m_running;
+        std::chrono::steady_clock::time_point m_start;
+};
+
+#endif /* __MLA_STATISTICS_H__ */
@@ -0,0 +1,84 @@
+/*
+ * File:   boundedqueue.h
+ */
+
+#ifndef __MLA_BOUNDEDQUEUE_H__
+#define __MLA_BOUNDEDQUEUE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <stddef.h>
+
+/*
+A queue between two stages of a pipeline, holding at most capacity items.
+Producers block while the queue is full, so that a fast stage can not run
+ahead of a slow one and pile up memory. Once the last producer closed the
+queue, consumers drain it and are then told that nothing more will come.
+*/
+template <typename T>
+class MLaBoundedQueue
+{
+    public:
+
+        /*
+        @param capacity: Largest number of queued items.
+        @param producers: Number of producers, each one calls close().
+        */
+        MLaBoundedQueue(size_t capacity, int producers)
+            : m_capacity(capacity > 0 ? capacity : 1), m_producers(producers)
+        {
+        }
+
+        // Queues an item, waiting for room.
+        void push(T &&item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notFull.wait(lock, [this] { return m_items.size() < m_capacity; });
+            m_items.push_back(std::move(item));
+            lock.unlock();
+            m_notEmpty.notify_one();
+        }
+
+        /*
+        Takes the oldest item, waiting for one.
+
+        @returns false if the queue is closed and empty.
+        */
+        bool pop(T &item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this] { return !m_items.empty() || m_producers == 0; });
+            if (m_items.empty())
+            {
+                return false;
+            }
+            item = std::move(m_items.front());
+            m_items.pop_front();
+            lock.unlock();
+            m_notFull.notify_one();
+            return true;
+        }
+
+        // Tells that a producer is done.
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_producers == 0)
+            {
+                m_notEmpty.notify_all();
+            }
+        }
+
+    private:
+
+        const size_t                m_capacity;
+        int                         m_producers;
+        std::mutex                  m_mutex;
+        std::condition_variable     m_notFull;
+        std::condition_variable     m_notEmpty;
+        std::deque<T>               m_items;
+};
+
+#endif /* __MLA_BOUNDEDQUEUE_H__ */
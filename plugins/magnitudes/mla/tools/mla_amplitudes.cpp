@@ -0,0 +1,624 @@
+/*
+ * File:   mla_amplitudes.cpp
+ *
+ * Computes MLa amplitudes of catalogued picks from a local SDS miniSEED
+ * archive, e.g. to backfill amplitudes of old events. Picks and origins are
+ * read from SCML files, every pick with an arrival in an origin gets one
+ * amplitude measured by Amplitude_MLA, with the time window for the
+ * distance of the first origin in the input referring to it. The amplitudes
+ * are written as SCML, in the order of the picks in the input. Gains are
+ * taken from an SCML inventory, no database, messaging or record stream
+ * server is needed.
+ *
+ * The channels go through a pipeline of three stages, each one running on
+ * its own threads so that reading and computing overlap:
+ *
+ *   read     the records of the time window from the archive
+ *   decode   the miniSEED records
+ *   measure  Wood-Anderson simulation and peak search by Amplitude_MLA
+ *
+ * The stages are connected by bounded queues, which bounds the number of
+ * channels held in memory whatever the size of the catalogue. The channel
+ * throughput, the time each stage was busy and the peak resident set size
+ * are reported at the end.
+ *
+ * Amplitudes are measured on the vertical channel of the stream the pick
+ * was made on, i.e. the last letter of the channel code is replaced by Z.
+ */
+
+#define SEISCOMP_COMPONENT MLa
+
+#include "../mla.h"
+#include "../bufferpool.h"
+#include "boundedqueue.h"
+
+#include <seiscomp/client/inventory.h>
+#include <seiscomp/config/config.h>
+#include <seiscomp/core/record.h>
+#include <seiscomp/datamodel/amplitude.h>
+#include <seiscomp/datamodel/arrival.h>
+#include <seiscomp/datamodel/eventparameters.h>
+#include <seiscomp/datamodel/inventory.h>
+#include <seiscomp/datamodel/origin.h>
+#include <seiscomp/datamodel/pick.h>
+#include <seiscomp/datamodel/publicobject.h>
+#include <seiscomp/io/archive/xmlarchive.h>
+#include <seiscomp/io/recordinput.h>
+#include <seiscomp/io/recordstream.h>
+#include <seiscomp/processing/stream.h>
+#include <seiscomp/utils/keyvalues.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char * const Author = "mla_amplitudes";
+
+struct Options
+{
+    std::vector<std::string>    inputs;
+    std::string                 inventory;
+    std::string                 archive;
+    std::string                 output;
+    std::string                 configFile;
+    std::vector<std::string>    settings;
+    int                         readers;
+    int                         decoders;
+    int                         threads;
+    int                         queue;
+
+    Options() : readers(2), decoders(1), threads(0), queue(0) {}
+};
+
+// A pick to measure, in input order.
+struct Job
+{
+    const Seiscomp::DataModel::Pick    *pick;
+    double                              distance;
+    double                              depth;
+    std::string                         networkCode;
+    std::string                         stationCode;
+    std::string                         locationCode;
+    std::string                         channelCode;
+};
+
+// A channel on its way through the pipeline.
+struct Channel
+{
+    size_t                                  job;
+    std::unique_ptr<Amplitude_MLA>          processor;
+    std::vector<Seiscomp::RecordPtr>        records;
+    // Why the channel can not be measured, empty if it can.
+    std::string                             error;
+};
+
+struct Measurement
+{
+    bool                                            valid;
+    Seiscomp::Processing::AmplitudeProcessor::Result result;
+    std::string                                     error;
+};
+
+// Time a stage spent working, summed over its threads.
+struct StageTime
+{
+    std::atomic<int64_t> nanoseconds;
+
+    StageTime() : nanoseconds(0) {}
+
+    void add(Clock::time_point start)
+    {
+        nanoseconds.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(),
+            std::memory_order_relaxed);
+    }
+
+    double seconds() const { return nanoseconds.load() * 1E-9; }
+};
+
+void usage(const char *program)
+{
+    std::cerr
+        << "Usage: " << program << " [options] INPUT..." << std::endl
+        << "  --inventory FILE    SCML inventory with the gains" << std::endl
+        << "  --archive DIR       SDS archive" << std::endl
+        << "  --output FILE       output file" << std::endl
+        << "  --config FILE       configuration with the amplitude parameters" << std::endl
+        << "  --set KEY=VALUE     sets a parameter, overrides --config" << std::endl
+        << "  --readers N         reading threads, default 2" << std::endl
+        << "  --decoders N        decoding threads, default 1" << std::endl
+        << "  --threads N         measuring threads, default one per core" << std::endl
+        << "  --queue N           channels queued between two stages, default" << std::endl
+        << "                      twice the measuring threads" << std::endl;
+}
+
+class Pipeline
+{
+    public:
+
+        Pipeline(const Options &options, const std::vector<Job> &jobs,
+                 const Seiscomp::Config::Config &config,
+                 const Seiscomp::Util::KeyValues &keys)
+            : m_options(options), m_jobs(jobs), m_config(config), m_keys(keys),
+              m_module(Author), m_next(0), m_results(jobs.size()),
+              m_decodeQueue(options.queue, options.readers),
+              m_measureQueue(options.queue, options.decoders)
+        {
+        }
+
+        // Runs all jobs through the pipeline.
+        void run()
+        {
+            std::vector<std::thread> threads;
+            for (int i = 0; i < m_options.readers; i++)
+            {
+                threads.push_back(std::thread(&Pipeline::read, this));
+            }
+            for (int i = 0; i < m_options.decoders; i++)
+            {
+                threads.push_back(std::thread(&Pipeline::decode, this));
+            }
+            for (int i = 0; i < m_options.threads; i++)
+            {
+                threads.push_back(std::thread(&Pipeline::measure, this));
+            }
+            for (size_t i = 0; i < threads.size(); i++)
+            {
+                threads[i].join();
+            }
+        }
+
+        const std::vector<Measurement> &results() const { return m_results; }
+
+        StageTime   reading;
+        StageTime   decoding;
+        StageTime   measuring;
+
+    private:
+
+        // Sets up the processor of a channel and reads its time window.
+        void read()
+        {
+            for (;;)
+            {
+                size_t job = m_next.fetch_add(1);
+                if (job >= m_jobs.size())
+                {
+                    break;
+                }
+
+                Clock::time_point start = Clock::now();
+                Channel channel;
+                channel.job = job;
+                prepare(m_jobs[job], channel);
+                if (channel.error.empty())
+                {
+                    fetch(m_jobs[job], channel);
+                }
+                reading.add(start);
+
+                m_decodeQueue.push(std::move(channel));
+            }
+            m_decodeQueue.close();
+        }
+
+        // Decodes the records of the channels.
+        void decode()
+        {
+            Channel channel;
+            while (m_decodeQueue.pop(channel))
+            {
+                Clock::time_point start = Clock::now();
+                for (size_t i = 0; i < channel.records.size(); i++)
+                {
+                    if (channel.records[i]->data() == NULL)
+                    {
+                        channel.error = "undecodable record";
+                        channel.records.clear();
+                        break;
+                    }
+                }
+                decoding.add(start);
+
+                m_measureQueue.push(std::move(channel));
+            }
+            m_measureQueue.close();
+        }
+
+        // Feeds the channels to their processors.
+        void measure()
+        {
+            Channel channel;
+            while (m_measureQueue.pop(channel))
+            {
+                Clock::time_point start = Clock::now();
+                Measurement &measurement = m_results[channel.job];
+                measurement.valid = false;
+                measurement.error = channel.error;
+                if (channel.error.empty())
+                {
+                    // Only the final amplitude is kept, should a provisional
+                    // one be emitted nevertheless.
+                    const Amplitude_MLA *processor = channel.processor.get();
+                    channel.processor->setResultCallback(
+                        [&measurement, processor](const Seiscomp::Processing::AmplitudeProcessor*,
+                                                  const Seiscomp::Record*,
+                                                  const Seiscomp::Processing::AmplitudeProcessor::Result &result)
+                        {
+                            if (processor->isProvisional())
+                            {
+                                return;
+                            }
+                            measurement.valid = true;
+                            measurement.result = result;
+                            measurement.result.record = NULL;
+                        });
+
+                    for (size_t i = 0; i < channel.records.size() && !channel.processor->isFinished(); i++)
+                    {
+                        channel.processor->feed(channel.records[i].get());
+                    }
+
+                    if (!measurement.valid)
+                    {
+                        measurement.error = channel.processor->isFinished() ?
+                            "no amplitude" : "not enough data";
+                    }
+                }
+                channel.processor.reset();
+                channel.records.clear();
+                measuring.add(start);
+            }
+        }
+
+        // Creates and configures the processor of a channel.
+        void prepare(const Job &job, Channel &channel)
+        {
+            Seiscomp::Core::Time trigger;
+            try
+            {
+                trigger = job.pick->time().value();
+            }
+            catch (...)
+            {
+                channel.error = "pick without time";
+                return;
+            }
+
+            channel.processor.reset(new Amplitude_MLA(trigger));
+            Amplitude_MLA &processor = *channel.processor;
+
+            Seiscomp::Processing::Stream stream;
+            stream.init(job.networkCode, job.stationCode, job.locationCode,
+                        job.channelCode, trigger);
+            if (stream.gain == 0)
+            {
+                channel.error = "no gain";
+                return;
+            }
+            processor.streamConfig(Seiscomp::Processing::WaveformProcessor::VerticalComponent) = stream;
+
+            Seiscomp::Processing::Settings settings(
+                m_module, job.networkCode, job.stationCode, job.locationCode,
+                job.channelCode, &m_config, &m_keys);
+            if (!processor.setup(settings))
+            {
+                channel.error = "setup failed";
+                return;
+            }
+
+            processor.setHint(Seiscomp::Processing::AmplitudeProcessor::Distance, job.distance);
+            processor.setHint(Seiscomp::Processing::AmplitudeProcessor::Depth, job.depth);
+            processor.computeTimeWindow();
+        }
+
+        // Reads the records of a channel from the archive.
+        void fetch(const Job &job, Channel &channel)
+        {
+            Seiscomp::IO::RecordStreamPtr archive =
+                Seiscomp::IO::RecordStream::Create("sdsarchive");
+            if (!archive || !archive->setSource(m_options.archive))
+            {
+                channel.error = "archive not available";
+                return;
+            }
+
+            Seiscomp::Core::TimeWindow window = channel.processor->safetyTimeWindow();
+            archive->addStream(job.networkCode, job.stationCode, job.locationCode,
+                               job.channelCode, window.startTime(), window.endTime());
+
+            // Decoded by the next stage.
+            Seiscomp::IO::RecordInput input(archive.get(), Seiscomp::Array::DOUBLE,
+                                            Seiscomp::Record::SAVE_RAW);
+            for (Seiscomp::IO::RecordIterator it = input.begin(); it != input.end(); ++it)
+            {
+                channel.records.push_back(Seiscomp::RecordPtr(*it));
+            }
+
+            if (channel.records.empty())
+            {
+                channel.error = "no data";
+            }
+        }
+
+        const Options                           &m_options;
+        const std::vector<Job>                  &m_jobs;
+        const Seiscomp::Config::Config          &m_config;
+        const Seiscomp::Util::KeyValues         &m_keys;
+        // Settings keeps a reference to it.
+        const std::string                        m_module;
+        std::atomic<size_t>                      m_next;
+        std::vector<Measurement>                 m_results;
+        MLaBoundedQueue<Channel>                 m_decodeQueue;
+        MLaBoundedQueue<Channel>                 m_measureQueue;
+};
+
+// Collects a job for every pick with an arrival, in input order.
+void collectJobs(Seiscomp::DataModel::EventParameters *parameters, std::vector<Job> &jobs)
+{
+    std::map<std::string, const Seiscomp::DataModel::Pick*> picks;
+    for (size_t i = 0; i < parameters->pickCount(); i++)
+    {
+        picks[parameters->pick(i)->publicID()] = parameters->pick(i);
+    }
+
+    // Distance and depth of the first origin referring to each pick.
+    std::map<std::string, std::pair<double, double> > located;
+    for (size_t i = 0; i < parameters->originCount(); i++)
+    {
+        Seiscomp::DataModel::Origin *origin = parameters->origin(i);
+        double depth;
+        try
+        {
+            depth = origin->depth().value();
+        }
+        catch (...)
+        {
+            continue;
+        }
+
+        for (size_t k = 0; k < origin->arrivalCount(); k++)
+        {
+            Seiscomp::DataModel::Arrival *arrival = origin->arrival(k);
+            try
+            {
+                located.insert(std::make_pair(arrival->pickID(),
+                                              std::make_pair(arrival->distance(), depth)));
+            }
+            catch (...)
+            {
+            }
+        }
+    }
+
+    for (size_t i = 0; i < parameters->pickCount(); i++)
+    {
+        const Seiscomp::DataModel::Pick *pick = parameters->pick(i);
+        std::map<std::string, std::pair<double, double> >::const_iterator it =
+            located.find(pick->publicID());
+        if (it == located.end() || pick->waveformID().channelCode().empty())
+        {
+            continue;
+        }
+
+        Job job;
+        job.pick = pick;
+        job.distance = it->second.first;
+        job.depth = it->second.second;
+        job.networkCode = pick->waveformID().networkCode();
+        job.stationCode = pick->waveformID().stationCode();
+        job.locationCode = pick->waveformID().locationCode();
+        job.channelCode = pick->waveformID().channelCode();
+        job.channelCode[job.channelCode.size() - 1] = 'Z';
+        jobs.push_back(job);
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if ((arg == "--inventory" || arg == "--archive" || arg == "--output" ||
+             arg == "--config" || arg == "--set" || arg == "--readers" ||
+             arg == "--decoders" || arg == "--threads" || arg == "--queue") &&
+            i + 1 < argc)
+        {
+            std::string value(argv[++i]);
+            if (arg == "--inventory") options.inventory = value;
+            else if (arg == "--archive") options.archive = value;
+            else if (arg == "--output") options.output = value;
+            else if (arg == "--config") options.configFile = value;
+            else if (arg == "--set") options.settings.push_back(value);
+            else if (arg == "--readers") options.readers = atoi(value.c_str());
+            else if (arg == "--decoders") options.decoders = atoi(value.c_str());
+            else if (arg == "--threads") options.threads = atoi(value.c_str());
+            else if (arg == "--queue") options.queue = atoi(value.c_str());
+        }
+        else if (!arg.empty() && arg[0] != '-')
+        {
+            options.inputs.push_back(arg);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.inputs.empty() || options.inventory.empty() ||
+        options.archive.empty() || options.output.empty() ||
+        options.readers < 1 || options.decoders < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.threads < 1)
+    {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (options.queue < 1)
+    {
+        options.queue = 2 * options.threads;
+    }
+
+    Seiscomp::Config::Config config;
+    if (!options.configFile.empty() && !config.readConfig(options.configFile))
+    {
+        std::cerr << "Can not read " << options.configFile << std::endl;
+        return 1;
+    }
+
+    Seiscomp::Util::KeyValues keys;
+    for (size_t i = 0; i < options.settings.size(); i++)
+    {
+        size_t equals = options.settings[i].find('=');
+        if (equals == std::string::npos)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        keys.setString(options.settings[i].substr(0, equals),
+                       options.settings[i].substr(equals + 1));
+    }
+
+    // The whole time window is in the archive, provisional amplitudes would
+    // only cost time.
+    keys.setString("amplitudes." GA_ML_AUS_AMP_TYPE ".provisionalInterval", "0");
+
+    Seiscomp::DataModel::PublicObject::SetRegistrableEnabled(false);
+
+    Seiscomp::DataModel::InventoryPtr inventory;
+    {
+        Seiscomp::IO::XMLArchive archive;
+        if (!archive.open(options.inventory.c_str()))
+        {
+            std::cerr << "Can not read " << options.inventory << std::endl;
+            return 1;
+        }
+        archive >> inventory;
+        archive.close();
+    }
+    if (!inventory)
+    {
+        std::cerr << "No inventory in " << options.inventory << std::endl;
+        return 1;
+    }
+    Seiscomp::Client::Inventory::Instance()->setInventory(inventory.get());
+
+    std::vector<Seiscomp::DataModel::EventParametersPtr> inputs(options.inputs.size());
+    std::vector<Job> jobs;
+    for (size_t f = 0; f < options.inputs.size(); f++)
+    {
+        Seiscomp::IO::XMLArchive archive;
+        if (!archive.open(options.inputs[f].c_str()))
+        {
+            std::cerr << "Can not read " << options.inputs[f] << std::endl;
+            return 1;
+        }
+        archive >> inputs[f];
+        archive.close();
+        if (!inputs[f])
+        {
+            std::cerr << "No event parameters in " << options.inputs[f] << std::endl;
+            return 1;
+        }
+        collectJobs(inputs[f].get(), jobs);
+    }
+
+    Clock::time_point start = Clock::now();
+    Pipeline pipeline(options, jobs, config, keys);
+    pipeline.run();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Seiscomp::DataModel::CreationInfo creationInfo;
+    creationInfo.setAuthor(Author);
+
+    Seiscomp::DataModel::EventParametersPtr output = new Seiscomp::DataModel::EventParameters;
+    std::map<std::string, size_t> errors;
+    size_t measured = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const Measurement &measurement = pipeline.results()[i];
+        if (!measurement.valid)
+        {
+            errors[measurement.error]++;
+            continue;
+        }
+
+        const Job &job = jobs[i];
+        const Seiscomp::Processing::AmplitudeProcessor::Result &result = measurement.result;
+        Seiscomp::DataModel::AmplitudePtr amplitude = Seiscomp::DataModel::Amplitude::Create(
+            job.pick->publicID() + "#" + GA_ML_AUS_AMP_TYPE);
+        amplitude->setType(GA_ML_AUS_AMP_TYPE);
+        amplitude->setAmplitude(Seiscomp::DataModel::RealQuantity(result.amplitude.value));
+#if SC_API_VERSION >= SC_API_VERSION_CHECK(12,0,0)
+        amplitude->setUnit("mm");
+#endif
+        amplitude->setTimeWindow(Seiscomp::DataModel::TimeWindow(
+            result.time.reference, result.time.begin, result.time.end));
+        if (result.period > 0)
+        {
+            amplitude->setPeriod(Seiscomp::DataModel::RealQuantity(result.period));
+        }
+        if (result.snr >= 0)
+        {
+            amplitude->setSnr(result.snr);
+        }
+        amplitude->setPickID(job.pick->publicID());
+        amplitude->setWaveformID(Seiscomp::DataModel::WaveformStreamID(
+            job.networkCode, job.stationCode, job.locationCode, job.channelCode, ""));
+        amplitude->setCreationInfo(creationInfo);
+        output->add(amplitude.get());
+        measured++;
+    }
+
+    {
+        Seiscomp::IO::XMLArchive archive;
+        if (!archive.create(options.output.c_str()))
+        {
+            std::cerr << "Can not write " << options.output << std::endl;
+            return 1;
+        }
+        archive.setFormattedOutput(true);
+        archive << output;
+        archive.close();
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::cerr << jobs.size() << " channels, " << measured << " amplitudes";
+    for (std::map<std::string, size_t>::const_iterator it = errors.begin(); it != errors.end(); ++it)
+    {
+        std::cerr << ", " << it->second << " " << it->first;
+    }
+    std::cerr << std::endl
+              << (seconds > 0 ? jobs.size() / seconds : 0) << " channels per second, "
+              << seconds << " s" << std::endl
+              << "busy: read " << pipeline.reading.seconds() << " s on "
+              << options.readers << " threads, decode " << pipeline.decoding.seconds()
+              << " s on " << options.decoders << " threads, measure "
+              << pipeline.measuring.seconds() << " s on " << options.threads
+              << " threads" << std::endl
+              << "data buffers: " << MLaBufferPool::reuses() << " reused, "
+              << MLaBufferPool::allocations() << " allocated" << std::endl
+              << "peak RSS " << usage.ru_maxrss / 1024.0 << " MB" << std::endl;
+
+    return 0;
+}
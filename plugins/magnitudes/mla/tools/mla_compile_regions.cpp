@@ -0,0 +1,237 @@
+/*
+ * File:   mla_compile_regions.cpp
+ *
+ * Compiles a bna region file into the binary format the MLa plugin loads at
+ * startup instead of parsing the bna file, see compiledregions.h. By default
+ * the compiled file is written next to the bna file, where the plugin looks
+ * for it.
+ *
+ * Before the compiled file is put in place, the region resolution from it is
+ * compared with GeoFeature::contains() on a grid of locations covering all
+ * regions and around every vertex. The file is not written if a single
+ * location resolves differently.
+ */
+
+#define SEISCOMP_COMPONENT MLa
+
+#include "../compiledregions.h"
+
+#include <seiscomp/geo/featureset.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+struct Options
+{
+    std::string input;
+    std::string output;
+    double      step;
+
+    Options() : step(0.05) {}
+};
+
+void usage(const char *program)
+{
+    std::cerr
+        << "Usage: " << program << " [options] BNAFILE" << std::endl
+        << "  --output FILE   compiled file, default BNAFILE"
+        << MLaCompiledRegionSuffix << std::endl
+        << "  --step DEG      spacing of the verification grid, default 0.05"
+        << std::endl;
+}
+
+/*
+Compares the region resolution of the compiled regions with the one of the
+features at a location.
+
+@returns Whether both agree.
+*/
+bool agree(const MLaCompiledRegionSet &compiled,
+           const std::vector<Seiscomp::Geo::GeoFeature*> &features,
+           double lat, double lon)
+{
+    Seiscomp::Geo::Vertex location;
+    location.lat = lat;
+    location.lon = lon;
+
+    int expected = -1;
+    for (size_t f = 0; f < features.size() && expected < 0; f++)
+    {
+        if (features[f]->contains(location))
+        {
+            expected = f;
+        }
+    }
+
+    int found = compiled.find(location);
+    if (found != expected)
+    {
+        fprintf(stderr, "Mismatch at %.6f/%.6f: compiled %d, bna %d\n",
+                lat, lon, found, expected);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+Verifies the compiled regions against the features.
+
+@returns The number of locations which resolve differently.
+*/
+size_t verify(const MLaCompiledRegionSet &compiled,
+              const Seiscomp::Geo::GeoFeatureSet &features,
+              const MLaRegionIndex &index, double step)
+{
+    const std::vector<Seiscomp::Geo::GeoFeature*> &list = features.features();
+    size_t mismatches = 0, locations = 0;
+
+    // A grid over the indexed regions with a margin.
+    double latMin = HUGE_VAL, latMax = -HUGE_VAL;
+    double lonMin = HUGE_VAL, lonMax = -HUGE_VAL;
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        const MLaRegionIndex::BoundingBox &box = index.box(i);
+        if (box.latMin > -HUGE_VAL && box.latMax < HUGE_VAL &&
+            box.lonMin > -HUGE_VAL && box.lonMax < HUGE_VAL)
+        {
+            latMin = std::min(latMin, box.latMin);
+            latMax = std::max(latMax, box.latMax);
+            lonMin = std::min(lonMin, box.lonMin);
+            lonMax = std::max(lonMax, box.lonMax);
+        }
+    }
+    if (latMin <= latMax)
+    {
+        for (double lat = latMin - 1; lat <= latMax + 1; lat += step)
+        {
+            for (double lon = lonMin - 1; lon <= lonMax + 1; lon += step)
+            {
+                mismatches += !agree(compiled, list, lat, lon);
+                locations++;
+            }
+        }
+    }
+
+    // Close to the vertices, where rounding matters most.
+    static const double offsets[] = { 0, 1E-3, -1E-3, 1E-5, -1E-5 };
+    const size_t count = sizeof(offsets) / sizeof(offsets[0]);
+    for (size_t f = 0; f < list.size(); f++)
+    {
+        const std::vector<Seiscomp::Geo::Vertex> &vertices = list[f]->vertices();
+        for (size_t v = 0; v < vertices.size(); v++)
+        {
+            for (size_t a = 0; a < count; a++)
+            {
+                for (size_t b = 0; b < count; b++)
+                {
+                    mismatches += !agree(compiled, list,
+                                         vertices[v].lat + offsets[a],
+                                         vertices[v].lon + offsets[b]);
+                    locations++;
+                }
+            }
+        }
+    }
+
+    std::cerr << "Verified " << locations << " locations, "
+              << mismatches << " mismatches" << std::endl;
+    return mismatches;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if ((arg == "--output" || arg == "--step") && i + 1 < argc)
+        {
+            std::string value(argv[++i]);
+            if (arg == "--output") options.output = value;
+            else if (arg == "--step") options.step = atof(value.c_str());
+        }
+        else if (arg[0] != '-' && options.input.empty())
+        {
+            options.input = arg;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.input.empty() || !(options.step > 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.output.empty())
+    {
+        options.output = options.input + MLaCompiledRegionSuffix;
+    }
+
+    struct stat info;
+    Seiscomp::Geo::Category category(1);
+    Seiscomp::Geo::GeoFeatureSet features;
+    if (stat(options.input.c_str(), &info) != 0 ||
+        !features.readBNAFile(options.input, &category))
+    {
+        std::cerr << "Can not read " << options.input << std::endl;
+        return 1;
+    }
+
+    MLaRegionIndex index;
+    index.build(features);
+
+    // Written under another name until it is verified, so that a good
+    // compiled file is not replaced by a bad one.
+    const std::string candidate = options.output + ".new";
+    std::string error;
+    if (!MLaCompiledRegionSet::write(candidate, features, index,
+                                     MLaFileVersion(info), error))
+    {
+        std::cerr << "Can not compile " << options.input << ": " << error << std::endl;
+        return 1;
+    }
+
+    std::shared_ptr<MLaCompiledRegionSet> compiled =
+        MLaCompiledRegionSet::open(candidate, options.input, MLaFileVersion(info), error);
+    if (!compiled)
+    {
+        std::cerr << "Can not read back " << candidate << ": " << error << std::endl;
+        unlink(candidate.c_str());
+        return 1;
+    }
+
+    if (verify(*compiled, features, index, options.step) > 0)
+    {
+        std::cerr << "Not writing " << options.output
+                  << ", the compiled regions do not match the bna file" << std::endl;
+        unlink(candidate.c_str());
+        return 1;
+    }
+
+    if (rename(candidate.c_str(), options.output.c_str()) != 0)
+    {
+        std::cerr << "Can not write " << options.output << std::endl;
+        unlink(candidate.c_str());
+        return 1;
+    }
+
+    std::cerr << "Wrote " << compiled->size() << " regions to "
+              << options.output << std::endl;
+    return 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * File:   mla_recompute.cpp
+ *
+ * Recomputes the MLa station and network magnitudes of catalogued origins,
+ * e.g. after the zones or their coefficients changed. Origins and MLa
+ * amplitudes are read from SCML files, the magnitudes are computed with
+ * Magnitude_MLA on all cores and the files are written again with the MLa
+ * magnitudes of every origin replaced. No database or messaging is needed.
+ *
+ * Station magnitudes are computed for every arrival of an origin which has
+ * a distance and an MLa amplitude of its pick, corrected by the station
+ * correction of the stream of the amplitude if mla.stationCorrectionFile is
+ * configured. Amplitudes are looked up in all inputs, the last one read
+ * wins if a pick has several. The network magnitude is averaged like scmag
+ * does by default: the mean of up to three station magnitudes, the 25%
+ * trimmed mean of more. Origins without a depth or without a single station
+ * magnitude computed keep their magnitudes and are counted as skipped.
+ *
+ * The output only depends on the input and the configuration: results are
+ * kept per origin and written in input order, and the public IDs of the new
+ * objects are derived from the IDs of the origin and amplitude.
+ */
+
+#define SEISCOMP_COMPONENT MLa
+
+#include "../mla.h"
+#include "networkmagnitude.h"
+#include "workpool.h"
+
+#include <seiscomp/config/config.h>
+#include <seiscomp/utils/keyvalues.h>
+#include <seiscomp/io/archive/xmlarchive.h>
+#include <seiscomp/datamodel/amplitude.h>
+#include <seiscomp/datamodel/arrival.h>
+#include <seiscomp/datamodel/eventparameters.h>
+#include <seiscomp/datamodel/magnitude.h>
+#include <seiscomp/datamodel/origin.h>
+#include <seiscomp/datamodel/publicobject.h>
+#include <seiscomp/datamodel/stationmagnitude.h>
+#include <seiscomp/datamodel/stationmagnitudecontribution.h>
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char * const Author = "mla_recompute";
+
+struct Options
+{
+    std::vector<std::string>    inputs;
+    std::string                 output;
+    std::string                 outputDirectory;
+    std::string                 configFile;
+    std::vector<std::string>    settings;
+    int                         threads;
+
+    Options() : threads(0) {}
+};
+
+// An origin to recompute, in input order.
+struct Job
+{
+    Seiscomp::DataModel::Origin *origin;
+    // Amplitude of each pick of all inputs, by pick ID.
+    const std::map<std::string, const Seiscomp::DataModel::Amplitude*> *amplitudes;
+};
+
+struct StationResult
+{
+    const Seiscomp::DataModel::Amplitude   *amplitude;
+    double                                  value;
+    double                                  weight;
+};
+
+struct OriginResult
+{
+    std::vector<StationResult>  stations;
+    double                      value;
+    double                      stddev;
+    // Station magnitudes which could not be computed.
+    size_t                      failed;
+};
+
+void usage(const char *program)
+{
+    std::cerr
+        << "Usage: " << program << " [options] INPUT..." << std::endl
+        << "  --config FILE       configuration with the mla.* parameters" << std::endl
+        << "  --set KEY=VALUE     sets a parameter, overrides --config" << std::endl
+        << "  --output FILE       output file for a single input" << std::endl
+        << "  --output-dir DIR    output directory, files keep their names" << std::endl
+        << "  --threads N         threads, default one per core" << std::endl;
+}
+
+/*
+Averages station magnitudes like scmag does by default (see
+MLaNetworkMagnitude) and sets the weight of their contributions.
+
+@param stations: The station magnitudes.
+@param value: The network magnitude.
+@param stddev: Its standard deviation.
+*/
+void average(std::vector<StationResult> &stations, double &value, double &stddev)
+{
+    MLaNetworkMagnitude network;
+    for (size_t i = 0; i < stations.size(); i++)
+    {
+        network.set(stations[i].amplitude->publicID(), stations[i].value);
+    }
+
+    MLaNetworkMagnitude::Result result;
+    network.compute(result);
+    value = result.value;
+    stddev = result.stddev;
+
+    for (size_t i = 0; i < stations.size(); i++)
+    {
+        stations[i].weight = network.weight(stations[i].amplitude->publicID());
+    }
+}
+
+// Computes the station and network magnitudes of an origin.
+void recompute(Magnitude_MLA &processor, const Job &job, OriginResult &result)
+{
+    Seiscomp::DataModel::Origin *origin = job.origin;
+    result.failed = 0;
+
+    double depth;
+    try
+    {
+        depth = origin->depth().value();
+    }
+    catch (...)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < origin->arrivalCount(); i++)
+    {
+        Seiscomp::DataModel::Arrival *arrival = origin->arrival(i);
+        std::map<std::string, const Seiscomp::DataModel::Amplitude*>::const_iterator it =
+            job.amplitudes->find(arrival->pickID());
+        if (it == job.amplitudes->end())
+        {
+            continue;
+        }
+
+        const Seiscomp::DataModel::Amplitude *amplitude = it->second;
+        double delta, value, period = -1, snr = -1;
+        try
+        {
+            delta = arrival->distance();
+            value = amplitude->amplitude().value();
+        }
+        catch (...)
+        {
+            result.failed++;
+            continue;
+        }
+        try { period = amplitude->period().value(); } catch (...) {}
+        try { snr = amplitude->snr(); } catch (...) {}
+
+        double magnitude;
+        Seiscomp::Processing::MagnitudeProcessor::Status status =
+            processor.computeMagnitude(
+                value,
+#if SC_API_VERSION >= SC_API_VERSION_CHECK(12,0,0)
+                amplitude->unit(),
+#endif
+                period,
+#if SC_API_VERSION >= SC_API_VERSION_CHECK(12,0,0)
+                snr,
+#endif
+                delta, depth, origin, NULL,
+#if SC_API_VERSION >= SC_API_VERSION_CHECK(12,0,0)
+                amplitude,
+#endif
+                magnitude);
+        if (status != Seiscomp::Processing::MagnitudeProcessor::OK)
+        {
+            result.failed++;
+            continue;
+        }
+
+        StationResult station = { amplitude, magnitude, 1.0 };
+        result.stations.push_back(station);
+    }
+
+    if (!result.stations.empty())
+    {
+        average(result.stations, result.value, result.stddev);
+    }
+}
+
+/*
+Replaces the magnitudes of the type of the processor of an origin. The
+origin is left as it is if no station magnitude was computed.
+*/
+void replace(const std::string &type, Seiscomp::DataModel::Origin *origin,
+             const OriginResult &result)
+{
+    if (result.stations.empty())
+    {
+        return;
+    }
+
+    for (size_t i = origin->stationMagnitudeCount(); i-- > 0; )
+    {
+        if (origin->stationMagnitude(i)->type() == type)
+        {
+            origin->removeStationMagnitude(i);
+        }
+    }
+    for (size_t i = origin->magnitudeCount(); i-- > 0; )
+    {
+        if (origin->magnitude(i)->type() == type)
+        {
+            origin->removeMagnitude(i);
+        }
+    }
+
+    Seiscomp::DataModel::CreationInfo creationInfo;
+    creationInfo.setAuthor(Author);
+
+    Seiscomp::DataModel::MagnitudePtr network = Seiscomp::DataModel::Magnitude::Create(
+        origin->publicID() + "#netMag." + type);
+    network->setType(type);
+    network->setMagnitude(Seiscomp::DataModel::RealQuantity(result.value, result.stddev));
+    network->setMethodID(result.stations.size() > 3 ? "trimmed mean(25)" : "mean");
+    network->setStationCount((int)result.stations.size());
+    network->setCreationInfo(creationInfo);
+
+    for (size_t i = 0; i < result.stations.size(); i++)
+    {
+        const StationResult &station = result.stations[i];
+
+        Seiscomp::DataModel::StationMagnitudePtr magnitude =
+            Seiscomp::DataModel::StationMagnitude::Create(
+                origin->publicID() + "#staMag." + type + "#" + station.amplitude->publicID());
+        magnitude->setOriginID(origin->publicID());
+        magnitude->setType(type);
+        magnitude->setMagnitude(Seiscomp::DataModel::RealQuantity(station.value));
+        magnitude->setAmplitudeID(station.amplitude->publicID());
+        magnitude->setWaveformID(station.amplitude->waveformID());
+        magnitude->setCreationInfo(creationInfo);
+        origin->add(magnitude.get());
+
+        Seiscomp::DataModel::StationMagnitudeContributionPtr contribution(
+            new Seiscomp::DataModel::StationMagnitudeContribution);
+        contribution->setStationMagnitudeID(magnitude->publicID());
+        contribution->setResidual(station.value - result.value);
+        contribution->setWeight(station.weight);
+        network->add(contribution.get());
+    }
+
+    origin->add(network.get());
+}
+
+std::string outputPath(const Options &options, const std::string &input)
+{
+    if (!options.output.empty())
+    {
+        return options.output;
+    }
+
+    size_t slash = input.rfind('/');
+    return options.outputDirectory + "/" +
+           (slash == std::string::npos ? input : input.substr(slash + 1));
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if ((arg == "--config" || arg == "--set" || arg == "--output" ||
+             arg == "--output-dir" || arg == "--threads") && i + 1 < argc)
+        {
+            std::string value(argv[++i]);
+            if (arg == "--config") options.configFile = value;
+            else if (arg == "--set") options.settings.push_back(value);
+            else if (arg == "--output") options.output = value;
+            else if (arg == "--output-dir") options.outputDirectory = value;
+            else if (arg == "--threads") options.threads = atoi(value.c_str());
+        }
+        else if (!arg.empty() && arg[0] != '-')
+        {
+            options.inputs.push_back(arg);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.inputs.empty() ||
+        options.output.empty() == options.outputDirectory.empty() ||
+        (!options.output.empty() && options.inputs.size() > 1))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Seiscomp::Config::Config config;
+    if (!options.configFile.empty() && !config.readConfig(options.configFile))
+    {
+        std::cerr << "Can not read " << options.configFile << std::endl;
+        return 1;
+    }
+
+    Seiscomp::Util::KeyValues keys;
+    for (size_t i = 0; i < options.settings.size(); i++)
+    {
+        size_t equals = options.settings[i].find('=');
+        if (equals == std::string::npos)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        keys.setString(options.settings[i].substr(0, equals),
+                       options.settings[i].substr(equals + 1));
+    }
+
+    // One processor serves all threads.
+    MLaWorkPool pool(options.threads);
+    // Settings keeps references to the codes.
+    const std::string module(Author), none;
+    Seiscomp::Processing::Settings settings(
+        module, none, none, none, none, &config, &keys);
+    Magnitude_MLA processor;
+    if (!processor.setup(settings))
+    {
+        std::cerr << "Can not set up the MLa magnitude processor" << std::endl;
+        return 1;
+    }
+    const std::string amplitudeType = processor.amplitudeType();
+    const std::string type = processor.type();
+
+    // The objects are only referred to by ID, registering millions of them
+    // would only cost time.
+    Seiscomp::DataModel::PublicObject::SetRegistrableEnabled(false);
+
+    Clock::time_point start = Clock::now();
+
+    // Origins may refer to picks of which the amplitudes are in another
+    // input, so the amplitudes of all inputs go into one map.
+    std::vector<Seiscomp::DataModel::EventParametersPtr> files(options.inputs.size());
+    std::map<std::string, const Seiscomp::DataModel::Amplitude*> amplitudes;
+    std::vector<Job> jobs;
+    for (size_t f = 0; f < options.inputs.size(); f++)
+    {
+        Seiscomp::IO::XMLArchive archive;
+        if (!archive.open(options.inputs[f].c_str()))
+        {
+            std::cerr << "Can not read " << options.inputs[f] << std::endl;
+            return 1;
+        }
+        archive >> files[f];
+        archive.close();
+        if (!files[f])
+        {
+            std::cerr << "No event parameters in " << options.inputs[f] << std::endl;
+            return 1;
+        }
+
+        for (size_t i = 0; i < files[f]->amplitudeCount(); i++)
+        {
+            const Seiscomp::DataModel::Amplitude *amplitude = files[f]->amplitude(i);
+            if (amplitude->type() == amplitudeType && !amplitude->pickID().empty())
+            {
+                amplitudes[amplitude->pickID()] = amplitude;
+            }
+        }
+
+        for (size_t i = 0; i < files[f]->originCount(); i++)
+        {
+            Job job = { files[f]->origin(i), &amplitudes };
+            jobs.push_back(job);
+        }
+    }
+
+    double reading = std::chrono::duration<double>(Clock::now() - start).count();
+    start = Clock::now();
+
+    std::vector<OriginResult> results(jobs.size());
+    pool.run(jobs.size(), [&](size_t task, int)
+    {
+        recompute(processor, jobs[task], results[task]);
+    });
+
+    double computing = std::chrono::duration<double>(Clock::now() - start).count();
+    start = Clock::now();
+
+    size_t stations = 0, failed = 0, networks = 0, skipped = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        replace(type, jobs[i].origin, results[i]);
+        stations += results[i].stations.size();
+        failed += results[i].failed;
+        networks += !results[i].stations.empty();
+        skipped += results[i].stations.empty();
+    }
+
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        const std::string path = outputPath(options, options.inputs[f]);
+        Seiscomp::IO::XMLArchive archive;
+        if (!archive.create(path.c_str()))
+        {
+            std::cerr << "Can not write " << path << std::endl;
+            return 1;
+        }
+        archive.setFormattedOutput(true);
+        archive << files[f];
+        archive.close();
+    }
+
+    double writing = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cerr << jobs.size() << " origins, " << skipped << " skipped, " << networks
+              << " network and " << stations << " station magnitudes, " << failed
+              << " failed" << std::endl
+              << "read " << reading << " s, computed " << computing << " s ("
+              << (computing > 0 ? stations / computing * 60 : 0)
+              << " station magnitudes per minute on " << pool.workers()
+              << " threads, " << pool.steals() << " steals), wrote "
+              << writing << " s" << std::endl;
+
+    return 0;
+}
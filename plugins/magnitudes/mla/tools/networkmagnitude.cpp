@@ -0,0 +1,420 @@
+#include "networkmagnitude.h"
+
+#include <algorithm>
+#include <math.h>
+
+
+// Fine enough to leave the magnitudes as they are for any practical purpose,
+// coarse enough for the sums of squares of MaxStations magnitudes below
+// MaxMagnitude, weighted in eighths, to stay exact in 128 bits.
+const double MLaNetworkMagnitude::Resolution = 1.0 / 4294967296.0;
+const double MLaNetworkMagnitude::MaxMagnitude = 100;
+
+namespace {
+
+const double Scale = 4294967296.0;
+
+}
+
+MLaNetworkMagnitude::MLaNetworkMagnitude()
+    : m_root(Nil), m_random(2463534242u)
+{
+}
+
+MLaNetworkMagnitude::MLaNetworkMagnitude(const MLaNetworkMagnitude &other)
+    : m_root(Nil), m_random(2463534242u)
+{
+    rebuild(other);
+}
+
+MLaNetworkMagnitude &MLaNetworkMagnitude::operator=(const MLaNetworkMagnitude &other)
+{
+    if (this != &other)
+    {
+        rebuild(other);
+    }
+    return *this;
+}
+
+void MLaNetworkMagnitude::rebuild(const MLaNetworkMagnitude &other)
+{
+    // The nodes point to the keys of the ID map, which can not be copied.
+    clear();
+    for (std::map<std::string, int64_t>::const_iterator it = other.m_ids.begin();
+         it != other.m_ids.end(); ++it)
+    {
+        std::map<std::string, int64_t>::iterator inserted =
+            m_ids.insert(*it).first;
+        insert(inserted->second, &inserted->first);
+    }
+}
+
+bool MLaNetworkMagnitude::set(const std::string &id, double value)
+{
+    if (!(fabs(value) < MaxMagnitude))
+    {
+        return false;
+    }
+    const int64_t fixed = (int64_t)llround(value * Scale);
+
+    std::map<std::string, int64_t>::iterator it = m_ids.find(id);
+    if (it != m_ids.end())
+    {
+        m_root = erase(m_root, it->second, it->first);
+        it->second = fixed;
+        insert(fixed, &it->first);
+        return true;
+    }
+
+    if (m_ids.size() >= MaxStations)
+    {
+        return false;
+    }
+    it = m_ids.insert(std::make_pair(id, fixed)).first;
+    insert(fixed, &it->first);
+    return true;
+}
+
+bool MLaNetworkMagnitude::remove(const std::string &id)
+{
+    std::map<std::string, int64_t>::iterator it = m_ids.find(id);
+    if (it == m_ids.end())
+    {
+        return false;
+    }
+
+    m_root = erase(m_root, it->second, it->first);
+    m_ids.erase(it);
+    return true;
+}
+
+void MLaNetworkMagnitude::clear()
+{
+    m_nodes.clear();
+    m_free.clear();
+    m_root = Nil;
+    m_ids.clear();
+}
+
+int64_t MLaNetworkMagnitude::eighths(size_t rank, size_t count)
+{
+    if (count <= 3)
+    {
+        return 8;
+    }
+
+    // The weight min(1, max(0, min(k + 1 - cut, n - k - cut))) of rank k
+    // with cut = n / 8, times 8.
+    const int64_t k = (int64_t)rank;
+    const int64_t n = (int64_t)count;
+    int64_t w = std::min(8 * (k + 1) - n, 8 * (n - k) - n);
+    return std::min((int64_t)8, std::max((int64_t)0, w));
+}
+
+bool MLaNetworkMagnitude::compute(Result &result) const
+{
+    const size_t n = m_ids.size();
+    if (n == 0)
+    {
+        return false;
+    }
+
+    // With cut = n / 8 = f + r / 8, ranks below f and above n - 1 - f have
+    // no weight, ranks f and n - 1 - f have 8 - r eighths and the ones in
+    // between full weight. Without trimming every rank has full weight.
+    const bool trimmed = n > 3;
+    const size_t f = trimmed ? n / 8 : 0;
+    const int64_t edge = eighths(f, n);
+
+    int64_t sum;
+    Int128 squares;
+    int64_t weights;
+    if (!trimmed)
+    {
+        const Node &root = m_nodes[m_root];
+        sum = 8 * root.sum;
+        squares = 8 * root.squares;
+        weights = 8 * (int64_t)n;
+    }
+    else
+    {
+        const Prefix low = prefix(f + 1);
+        const Prefix high = prefix(n - f - 1);
+        const int64_t first = select(f);
+        const int64_t last = select(n - 1 - f);
+
+        sum = 8 * (high.sum - low.sum) + edge * (first + last);
+        squares = 8 * (high.squares - low.squares) +
+                  (Int128)edge * ((Int128)first * first + (Int128)last * last);
+        weights = 8 * (int64_t)(n - 2 * f - 2) + 2 * edge;
+    }
+
+    result.count = n;
+    result.trimmed = trimmed;
+    result.weight = weights / 8.0;
+    result.value = (double)sum / (double)weights / Scale;
+
+    // sum(w (v - mean)^2) / (W - 1), from the exact sums: with the weights
+    // in eighths (W8) and the values in units of Resolution, this is
+    // (W8 squares - sum^2) / (W8 (W8 - 8)) / Scale^2.
+    if (weights > 8)
+    {
+        Int128 numerator = (Int128)weights * squares - (Int128)sum * sum;
+        result.stddev = sqrt((double)numerator / ((double)weights * (double)(weights - 8))) / Scale;
+    }
+    else
+    {
+        result.stddev = 0;
+    }
+
+    if (n % 2 == 1)
+    {
+        result.median = (double)select(n / 2) / Scale;
+    }
+    else
+    {
+        result.median = ((double)select(n / 2 - 1) + (double)select(n / 2)) / 2 / Scale;
+    }
+
+    return true;
+}
+
+double MLaNetworkMagnitude::weight(const std::string &id) const
+{
+    std::map<std::string, int64_t>::const_iterator it = m_ids.find(id);
+    if (it == m_ids.end())
+    {
+        return -1;
+    }
+
+    return eighths(rank(it->second, it->first), m_ids.size()) / 8.0;
+}
+
+bool MLaNetworkMagnitude::less(int64_t value, const std::string &id, const Node &node) const
+{
+    if (value != node.value)
+    {
+        return value < node.value;
+    }
+    return id < *node.id;
+}
+
+void MLaNetworkMagnitude::update(int32_t index)
+{
+    Node &node = m_nodes[index];
+    node.count = 1;
+    node.sum = node.value;
+    node.squares = (Int128)node.value * node.value;
+    if (node.left != Nil)
+    {
+        const Node &left = m_nodes[node.left];
+        node.count += left.count;
+        node.sum += left.sum;
+        node.squares += left.squares;
+    }
+    if (node.right != Nil)
+    {
+        const Node &right = m_nodes[node.right];
+        node.count += right.count;
+        node.sum += right.sum;
+        node.squares += right.squares;
+    }
+}
+
+void MLaNetworkMagnitude::split(int32_t index, int64_t value, const std::string &id,
+                                int32_t &left, int32_t &right)
+{
+    // Nodes ordered before the key go left, the others right.
+    if (index == Nil)
+    {
+        left = right = Nil;
+        return;
+    }
+
+    Node &node = m_nodes[index];
+    if (less(value, id, node) || (value == node.value && id == *node.id))
+    {
+        split(node.left, value, id, left, m_nodes[index].left);
+        right = index;
+    }
+    else
+    {
+        split(node.right, value, id, m_nodes[index].right, right);
+        left = index;
+    }
+    update(index);
+}
+
+int32_t MLaNetworkMagnitude::merge(int32_t left, int32_t right)
+{
+    if (left == Nil)
+    {
+        return right;
+    }
+    if (right == Nil)
+    {
+        return left;
+    }
+
+    if (m_nodes[left].priority > m_nodes[right].priority)
+    {
+        int32_t merged = merge(m_nodes[left].right, right);
+        m_nodes[left].right = merged;
+        update(left);
+        return left;
+    }
+
+    int32_t merged = merge(left, m_nodes[right].left);
+    m_nodes[right].left = merged;
+    update(right);
+    return right;
+}
+
+void MLaNetworkMagnitude::insert(int64_t value, const std::string *id)
+{
+    int32_t index;
+    if (!m_free.empty())
+    {
+        index = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        index = (int32_t)m_nodes.size();
+        m_nodes.push_back(Node());
+    }
+
+    // Xorshift, the shape of the tree does not change any result.
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+
+    Node &node = m_nodes[index];
+    node.value = value;
+    node.id = id;
+    node.priority = m_random;
+    node.left = node.right = Nil;
+    update(index);
+
+    int32_t left, right;
+    split(m_root, value, *id, left, right);
+    m_root = merge(merge(left, index), right);
+}
+
+int32_t MLaNetworkMagnitude::erase(int32_t index, int64_t value, const std::string &id)
+{
+    if (index == Nil)
+    {
+        return Nil;
+    }
+
+    Node &node = m_nodes[index];
+    if (value == node.value && id == *node.id)
+    {
+        m_free.push_back(index);
+        return merge(node.left, node.right);
+    }
+
+    if (less(value, id, node))
+    {
+        node.left = erase(node.left, value, id);
+    }
+    else
+    {
+        node.right = erase(node.right, value, id);
+    }
+    update(index);
+    return index;
+}
+
+MLaNetworkMagnitude::Prefix MLaNetworkMagnitude::prefix(size_t count) const
+{
+    Prefix result = { 0, 0 };
+    int32_t index = m_root;
+    while (index != Nil && count > 0)
+    {
+        const Node &node = m_nodes[index];
+        const size_t left = node.left != Nil ? m_nodes[node.left].count : 0;
+        if (count <= left)
+        {
+            index = node.left;
+            continue;
+        }
+
+        if (node.left != Nil)
+        {
+            result.sum += m_nodes[node.left].sum;
+            result.squares += m_nodes[node.left].squares;
+        }
+        result.sum += node.value;
+        result.squares += (Int128)node.value * node.value;
+        count -= left + 1;
+        index = node.right;
+    }
+    return result;
+}
+
+int64_t MLaNetworkMagnitude::select(size_t rank) const
+{
+    int32_t index = m_root;
+    for (;;)
+    {
+        const Node &node = m_nodes[index];
+        const size_t left = node.left != Nil ? m_nodes[node.left].count : 0;
+        if (rank < left)
+        {
+            index = node.left;
+        }
+        else if (rank == left)
+        {
+            return node.value;
+        }
+        else
+        {
+            rank -= left + 1;
+            index = node.right;
+        }
+    }
+}
+
+size_t MLaNetworkMagnitude::rank(int64_t value, const std::string &id) const
+{
+    size_t result = 0;
+    int32_t index = m_root;
+    while (index != Nil)
+    {
+        const Node &node = m_nodes[index];
+        const size_t left = node.left != Nil ? m_nodes[node.left].count : 0;
+        if (value == node.value && id == *node.id)
+        {
+            return result + left;
+        }
+
+        if (less(value, id, node))
+        {
+            index = node.left;
+        }
+        else
+        {
+            result += left + 1;
+            index = node.right;
+        }
+    }
+    return result;
+}
+
+MLaNetworkMagnitude &MLaNetworkAggregator::origin(const std::string &originID)
+{
+    return m_origins[originID];
+}
+
+const MLaNetworkMagnitude *MLaNetworkAggregator::find(const std::string &originID) const
+{
+    std::map<std::string, MLaNetworkMagnitude>::const_iterator it = m_origins.find(originID);
+    return it != m_origins.end() ? &it->second : NULL;
+}
+
+bool MLaNetworkAggregator::forget(const std::string &originID)
+{
+    return m_origins.erase(originID) > 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * File:   networkmagnitude.h
+ */
+
+#ifndef __MLA_NETWORKMAGNITUDE_H__
+#define __MLA_NETWORKMAGNITUDE_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/*
+Network MLa of one origin, updated station magnitude by station magnitude.
+The value is averaged like scmag does by default: the mean of up to three
+station magnitudes, otherwise the 25% trimmed mean, where a station
+magnitude partly within the cut keeps the remaining fraction of its weight.
+The median and the weighted standard deviation are kept as well.
+
+The station magnitudes are kept sorted in a balanced tree which also holds
+the sums of the values and their squares of every subtree, so that adding,
+replacing or removing a station magnitude and computing the network values
+take logarithmic time. The sums are exact integers over the values rounded
+to Resolution, so the network values depend on the set of station
+magnitudes only: they are bit identical to those of an MLaNetworkMagnitude
+built from scratch from the same station magnitudes in any order.
+
+They are not those of a computation on the unrounded values, though. Every
+value is off by at most Resolution / 2, so the mean, the trimmed mean and
+the median are within 2^-33 and the standard deviation within 2^-32 of the
+exact ones, plus the rounding of the few double operations computing them
+from the sums.
+*/
+class MLaNetworkMagnitude
+{
+    public:
+
+        // Magnitudes are rounded to multiples of this (2^-32).
+        static const double Resolution;
+
+        // Station magnitudes of at least this size are not accepted.
+        static const double MaxMagnitude;
+
+        // Largest number of station magnitudes.
+        static const size_t MaxStations = 65536;
+
+        struct Result
+        {
+            double  value;      // the (trimmed) mean
+            double  stddev;     // its weighted standard deviation
+            double  median;
+            double  weight;     // the sum of the weights
+            size_t  count;      // the number of station magnitudes
+            bool    trimmed;    // whether value is the trimmed mean
+        };
+
+        MLaNetworkMagnitude();
+        MLaNetworkMagnitude(const MLaNetworkMagnitude &other);
+        MLaNetworkMagnitude &operator=(const MLaNetworkMagnitude &other);
+
+        /*
+        Adds a station magnitude or replaces its value.
+
+        @param id: Identifies the station magnitude, e.g. its public ID.
+                   Equal values are ordered by it.
+        @param value: The station magnitude.
+        @returns false if the value is not finite or too large, or there are
+                 MaxStations station magnitudes already.
+        */
+        bool set(const std::string &id, double value);
+
+        /*
+        Removes a station magnitude.
+
+        @returns false if there is none with the ID.
+        */
+        bool remove(const std::string &id);
+
+        // Removes all station magnitudes.
+        void clear();
+
+        // Returns the number of station magnitudes.
+        size_t size() const { return m_ids.size(); }
+
+        /*
+        Computes the network values.
+
+        @returns false if there are no station magnitudes.
+        */
+        bool compute(Result &result) const;
+
+        /*
+        Returns the weight of a station magnitude in the network value,
+        from 0 to 1, or -1 if there is none with the ID.
+        */
+        double weight(const std::string &id) const;
+
+    private:
+
+        __extension__ typedef __int128 Int128;
+
+        static const int32_t Nil = -1;
+
+        struct Node
+        {
+            int64_t             value;      // in units of Resolution
+            const std::string  *id;         // the key in m_ids
+            uint32_t            priority;
+            int32_t             left;
+            int32_t             right;
+            uint32_t            count;      // of the subtree
+            int64_t             sum;        // of the subtree values
+            Int128              squares;    // of the subtree values
+        };
+
+        // Sums over the smallest values.
+        struct Prefix
+        {
+            int64_t sum;
+            Int128  squares;
+        };
+
+        bool less(int64_t value, const std::string &id, const Node &node) const;
+        void update(int32_t node);
+        void split(int32_t node, int64_t value, const std::string &id,
+                   int32_t &left, int32_t &right);
+        int32_t merge(int32_t left, int32_t right);
+        void insert(int64_t value, const std::string *id);
+        // Removes a key from a subtree, returning the new subtree.
+        int32_t erase(int32_t node, int64_t value, const std::string &id);
+
+        // Sums of the count smallest values.
+        Prefix prefix(size_t count) const;
+        // The value of rank (from 0).
+        int64_t select(size_t rank) const;
+        // The number of station magnitudes ordered before a key.
+        size_t rank(int64_t value, const std::string &id) const;
+
+        // Weight of a rank in eighths, the cut being a multiple of 1/8.
+        static int64_t eighths(size_t rank, size_t count);
+
+        void rebuild(const MLaNetworkMagnitude &other);
+
+        std::vector<Node>               m_nodes;
+        std::vector<int32_t>            m_free;
+        int32_t                         m_root;
+        uint32_t                        m_random;
+        std::map<std::string, int64_t>  m_ids;
+};
+
+/*
+The network MLa of every origin being processed, by origin ID.
+*/
+class MLaNetworkAggregator
+{
+    public:
+
+        // Returns the network magnitude of an origin, creating it if need be.
+        MLaNetworkMagnitude &origin(const std::string &originID);
+
+        // Returns the network magnitude of an origin, NULL if there is none.
+        const MLaNetworkMagnitude *find(const std::string &originID) const;
+
+        // Forgets an origin, e.g. once it is final.
+        bool forget(const std::string &originID);
+
+        // Returns the number of origins.
+        size_t size() const { return m_origins.size(); }
+
+    private:
+
+        std::map<std::string, MLaNetworkMagnitude> m_origins;
+};
+
+#endif /* __MLA_NETWORKMAGNITUDE_H__ */
@@ -0,0 +1,113 @@
+#include "workpool.h"
+
+#include <algorithm>
+#include <thread>
+
+
+MLaWorkPool::MLaWorkPool(int workers)
+    : m_shares(workers > 0 ? workers : std::max(1u, std::thread::hardware_concurrency())),
+      m_steals(0)
+{
+}
+
+void MLaWorkPool::run(size_t count, const Task &task)
+{
+    const size_t n = m_shares.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        m_shares[i].begin = count * i / n;
+        m_shares[i].end = count * (i + 1) / n;
+        m_shares[i].steals = 0;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n; i++)
+    {
+        threads.push_back(std::thread(&MLaWorkPool::work, this, (int)i, std::cref(task)));
+    }
+    work(0, task);
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+
+    m_steals = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        m_steals += m_shares[i].steals;
+    }
+}
+
+void MLaWorkPool::work(int worker, const Task &task)
+{
+    Share &share = m_shares[worker];
+    for (;;)
+    {
+        size_t next = 0;
+        bool found = false;
+        {
+            std::lock_guard<std::mutex> lock(share.mutex);
+            if (share.begin < share.end)
+            {
+                next = share.begin++;
+                found = true;
+            }
+        }
+
+        if (found)
+        {
+            task(next, worker);
+        }
+        else if (!steal(worker))
+        {
+            // All tasks left are held by other threads, which run them.
+            return;
+        }
+    }
+}
+
+bool MLaWorkPool::steal(int worker)
+{
+    const int n = (int)m_shares.size();
+    for (;;)
+    {
+        // Pick the largest share, the sizes are only a hint.
+        int victim = -1;
+        size_t largest = 0;
+        for (int i = 1; i < n; i++)
+        {
+            int candidate = (worker + i) % n;
+            std::lock_guard<std::mutex> lock(m_shares[candidate].mutex);
+            size_t left = m_shares[candidate].end - m_shares[candidate].begin;
+            if (left > largest)
+            {
+                largest = left;
+                victim = candidate;
+            }
+        }
+        if (victim < 0)
+        {
+            return false;
+        }
+
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> lock(m_shares[victim].mutex);
+            Share &share = m_shares[victim];
+            if (share.begin >= share.end)
+            {
+                // Emptied in the meantime, look again.
+                continue;
+            }
+            end = share.end;
+            begin = share.begin + (share.end - share.begin) / 2;
+            share.end = begin;
+        }
+
+        std::lock_guard<std::mutex> lock(m_shares[worker].mutex);
+        m_shares[worker].begin = begin;
+        m_shares[worker].end = end;
+        m_shares[worker].steals++;
+        return true;
+    }
+}
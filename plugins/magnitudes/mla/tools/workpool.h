@@ -0,0 +1,74 @@
+/*
+ * File:   workpool.h
+ */
+
+#ifndef __MLA_WORKPOOL_H__
+#define __MLA_WORKPOOL_H__
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <stddef.h>
+
+/*
+Runs a range of independent tasks on a fixed number of threads. Every thread
+starts with an even share of the range and takes tasks from the front of its
+share. A thread which runs out of tasks steals the back half of the largest
+remaining share of another thread, so uneven tasks (origins with many or few
+amplitudes) do not leave threads idle. Which thread runs which task varies
+from run to run, callers needing deterministic results store them by task.
+*/
+class MLaWorkPool
+{
+    public:
+
+        /*
+        Runs a task.
+
+        @param task: Position of the task in the range.
+        @param worker: Number of the thread running it, from 0 to
+                       workers() - 1, e.g. to pick per thread state.
+        */
+        typedef std::function<void (size_t task, int worker)> Task;
+
+        /*
+        @param workers: Number of threads, 0 for one per core. The calling
+                        thread is one of them.
+        */
+        explicit MLaWorkPool(int workers);
+
+        // Returns the number of threads.
+        int workers() const { return (int)m_shares.size(); }
+
+        /*
+        Runs task for every position in [0, count) and returns when all
+        tasks are done.
+        */
+        void run(size_t count, const Task &task);
+
+        // Returns the number of steals during the last run.
+        size_t steals() const { return m_steals; }
+
+    private:
+
+        // The tasks a thread has left, [begin, end).
+        struct Share
+        {
+            std::mutex  mutex;
+            size_t      begin;
+            size_t      end;
+            size_t      steals;
+        };
+
+        // Runs the tasks of one thread until there are none left anywhere.
+        void work(int worker, const Task &task);
+
+        // Moves half of the largest other share to the share of worker.
+        bool steal(int worker);
+
+        std::vector<Share>  m_shares;
+        size_t              m_steals;
+};
+
+#endif /* __MLA_WORKPOOL_H__ */
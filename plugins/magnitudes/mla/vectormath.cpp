@@ -0,0 +1,358 @@
+#define SEISCOMP_COMPONENT MLa
+
+#include "vectormath.h"
+#include "mla.h"
+
+#include <seiscomp/math/geo.h>
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MLA_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+typedef void (*BatchKernel)(const MLaCoefficients &coefficients, size_t count,
+                            const double *amplitudes, const double *deltas,
+                            const double *depths, double *values);
+
+// Evaluates values [begin, end) exactly like Magnitude_MLA::computeMagnitude.
+void evaluateScalar(const MLaCoefficients &coefficients,
+                    size_t begin, size_t end,
+                    const double *amplitudes, const double *deltas,
+                    const double *depths, double *values)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        values[i] = Magnitude_MLA::formula(
+            coefficients, amplitudes[i], Magnitude_MLA::distance(deltas[i], depths[i]));
+    }
+}
+
+void batchScalar(const MLaCoefficients &coefficients, size_t count,
+                 const double *amplitudes, const double *deltas,
+                 const double *depths, double *values)
+{
+    evaluateScalar(coefficients, 0, count, amplitudes, deltas, depths, values);
+}
+
+typedef size_t (*AbsMaxKernel)(const double *data, size_t begin, size_t end,
+                               double offset);
+
+// Continues an absolute maximum search at begin, keeping the first maximum.
+size_t absMaxScalar(const double *data, size_t begin, size_t end,
+                    double offset, size_t imax, double amax)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        double a = fabs(data[i] - offset);
+        if (a > amax)
+        {
+            amax = a;
+            imax = i;
+        }
+    }
+    return imax;
+}
+
+size_t absMaxScalar(const double *data, size_t begin, size_t end, double offset)
+{
+    if (begin >= end)
+    {
+        return begin;
+    }
+    return absMaxScalar(data, begin + 1, end, offset, begin, fabs(data[begin] - offset));
+}
+
+#ifdef MLA_X86_KERNELS
+
+typedef double             v2d __attribute__((vector_size(16)));
+typedef unsigned long long v2u __attribute__((vector_size(16)));
+typedef double             v4d __attribute__((vector_size(32)));
+typedef unsigned long long v4u __attribute__((vector_size(32)));
+
+template <typename VD> struct Lanes;
+template <> struct Lanes<v2d> { typedef v2u Bits; enum { Count = 2 }; };
+template <> struct Lanes<v4d> { typedef v4u Bits; enum { Count = 4 }; };
+
+// The helpers take and return vectors by reference, the ABI of 32 byte
+// vectors passed by value depends on whether AVX is enabled.
+__attribute__((target("sse2"))) inline void vsqrt(const v2d &x, v2d &y)
+{
+    y = (v2d)_mm_sqrt_pd((__m128d)x);
+}
+
+__attribute__((target("avx2"))) inline void vsqrt(const v4d &x, v4d &y)
+{
+    y = (v4d)_mm256_sqrt_pd((__m256d)x);
+}
+
+template <typename VD>
+inline bool allNormal(const VD &x)
+{
+    for (int k = 0; k < Lanes<VD>::Count; k++)
+    {
+        if (!(x[k] >= DBL_MIN && x[k] <= DBL_MAX))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+log10 of positive, normal, finite values. This is the algorithm of the
+FreeBSD msun e_log10.c (itself based on fdlibm) with the branches turned into
+lane selects, within 2 ULP of the C library log10. The result is stored
+in y.
+*/
+template <typename VD>
+inline void vlog10(const VD &x, VD &y)
+{
+    typedef typename Lanes<VD>::Bits VU;
+
+    const double two52 = 4503599627370496.0;
+    const double ivln10hi = 4.34294481878168880939e-01;
+    const double ivln10lo = 2.50829467116452752298e-11;
+    const double log10_2hi = 3.01029995663611771306e-01;
+    const double log10_2lo = 3.69423907715893078616e-13;
+    const double Lg1 = 6.666666666666735130e-01;
+    const double Lg2 = 3.999999999940941908e-01;
+    const double Lg3 = 2.857142874366239149e-01;
+    const double Lg4 = 2.222219843214978396e-01;
+    const double Lg5 = 1.818357216161805012e-01;
+    const double Lg6 = 1.531383769920937332e-01;
+    const double Lg7 = 1.479819860511658591e-01;
+
+    // Split x into 2^k * m with m in [1, 2), then move m into
+    // [sqrt(2)/2, sqrt(2)).
+    const VU bits = (VU)x;
+    VD m = (VD)((bits & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL);
+    VD k = (VD)((bits >> 52) | 0x4330000000000000ULL) - (two52 + 1023.0);
+    const auto large = m > M_SQRT2;
+    m = large ? m * 0.5 : m;
+    k = large ? k + 1.0 : k;
+
+    const VD f = m - 1.0;
+    const VD hfsq = 0.5 * f * f;
+    const VD s = f / (2.0 + f);
+    const VD z = s * s;
+    const VD w = z * z;
+    const VD t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+    const VD t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+    const VD r = s * (hfsq + t2 + t1);
+
+    // log(m) = hi + lo, where hi has its lower 32 bits cleared so that
+    // hi * ivln10hi is exact.
+    const VD hi = (VD)((VU)(f - hfsq) & 0xFFFFFFFF00000000ULL);
+    const VD lo = (f - hi) - hfsq + r;
+
+    VD valHi = hi * ivln10hi;
+    const VD y2 = k * log10_2hi;
+    VD valLo = k * log10_2lo + (lo + hi) * ivln10lo + lo * ivln10hi;
+
+    const VD sum = y2 + valHi;
+    valLo += (y2 - sum) + valHi;
+    valHi = sum;
+
+    y = valLo + valHi;
+}
+
+template <typename VD>
+inline void evaluateVector(const MLaCoefficients &coefficients, size_t count,
+                               const double *amplitudes, const double *deltas,
+                               const double *depths, double *values)
+{
+    const size_t lanes = Lanes<VD>::Count;
+    const double kmPerDegree = Seiscomp::Math::Geo::deg2km(1.0);
+
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+    {
+        VD a, delta, depth;
+        memcpy(&a, amplitudes + i, sizeof(VD));
+        memcpy(&delta, deltas + i, sizeof(VD));
+        memcpy(&depth, depths + i, sizeof(VD));
+
+        // Same operations in the same order as Magnitude_MLA::distance, the
+        // square root is correctly rounded in both.
+        const VD deltaKms = delta * kmPerDegree;
+        VD r;
+        vsqrt(depth * depth + deltaKms * deltaKms, r);
+        const VD x = r * coefficients.c3 + coefficients.c4;
+
+        if (!allNormal(a) || !allNormal(x))
+        {
+            evaluateScalar(coefficients, i, i + lanes,
+                           amplitudes, deltas, depths, values);
+            continue;
+        }
+
+        VD logA, logX;
+        vlog10(a, logA);
+        vlog10(x, logX);
+        const VD v = (
+                coefficients.c0 * logA +
+                (coefficients.c1 * logX) +
+                (coefficients.c5 * (r + coefficients.c6)) + coefficients.c2);
+        memcpy(values + i, &v, sizeof(VD));
+    }
+
+    evaluateScalar(coefficients, i, count, amplitudes, deltas, depths, values);
+}
+
+/*
+Every lane keeps the first maximum of its samples and the index thereof,
+the lane maxima are then reduced to the first overall one. Samples which
+are NaN never compare greater and are skipped like in the scalar search.
+*/
+template <typename VD>
+inline size_t absMaxVector(const double *data, size_t begin, size_t end,
+                           double offset)
+{
+    typedef typename Lanes<VD>::Bits VU;
+    const size_t lanes = Lanes<VD>::Count;
+
+    // The scalar search starts off with the first sample, even if it is NaN.
+    if (end - begin < 2 * lanes || !(fabs(data[begin] - offset) >= 0))
+    {
+        return absMaxScalar(data, begin, end, offset);
+    }
+
+    // Two sets of lanes, interleaved, to hide the latency of the compare
+    // and select chain.
+    VU absMask;
+    VD best[2], bestIndex[2], index[2];
+    for (size_t k = 0; k < lanes; k++)
+    {
+        absMask[k] = 0x7fffffffffffffffULL;
+        best[0][k] = best[1][k] = -1;
+        bestIndex[0][k] = bestIndex[1][k] = 0;
+        index[0][k] = (double)(begin + k);
+        index[1][k] = (double)(begin + lanes + k);
+    }
+
+    size_t i = begin;
+    for (; i + 2 * lanes <= end; i += 2 * lanes)
+    {
+        for (int s = 0; s < 2; s++)
+        {
+            VD x;
+            memcpy(&x, data + i + s * lanes, sizeof(VD));
+
+            const VD a = (VD)((VU)(x - offset) & absMask);
+            const VU greater = (VU)(a > best[s]);
+            best[s] = (VD)(((VU)a & greater) | ((VU)best[s] & ~greater));
+            bestIndex[s] = (VD)(((VU)index[s] & greater) | ((VU)bestIndex[s] & ~greater));
+            index[s] += (double)(2 * lanes);
+        }
+    }
+
+    // The first sample is in lane 0 of the first set and not NaN, so that
+    // lane holds a maximum.
+    size_t imax = (size_t)bestIndex[0][0];
+    double amax = best[0][0];
+    for (int s = 0; s < 2; s++)
+    {
+        for (size_t k = 0; k < lanes; k++)
+        {
+            size_t ik = (size_t)bestIndex[s][k];
+            if (best[s][k] > amax || (best[s][k] == amax && ik < imax))
+            {
+                amax = best[s][k];
+                imax = ik;
+            }
+        }
+    }
+
+    return absMaxScalar(data, i, end, offset, imax, amax);
+}
+
+// The kernels are flattened, i.e. the templates above are inlined and
+// compiled for the instruction set of the kernel.
+__attribute__((target("sse2"), flatten))
+void batchSSE2(const MLaCoefficients &coefficients, size_t count,
+               const double *amplitudes, const double *deltas,
+               const double *depths, double *values)
+{
+    evaluateVector<v2d>(coefficients, count, amplitudes, deltas, depths, values);
+}
+
+__attribute__((target("avx2"), flatten))
+void batchAVX2(const MLaCoefficients &coefficients, size_t count,
+               const double *amplitudes, const double *deltas,
+               const double *depths, double *values)
+{
+    evaluateVector<v4d>(coefficients, count, amplitudes, deltas, depths, values);
+}
+
+__attribute__((target("sse2"), flatten))
+size_t absMaxSSE2(const double *data, size_t begin, size_t end, double offset)
+{
+    return absMaxVector<v2d>(data, begin, end, offset);
+}
+
+__attribute__((target("avx2"), flatten))
+size_t absMaxAVX2(const double *data, size_t begin, size_t end, double offset)
+{
+    return absMaxVector<v4d>(data, begin, end, offset);
+}
+
+#endif
+
+struct KernelChoice
+{
+    KernelChoice() : kernel(batchScalar), absMax(absMaxScalar), name("scalar")
+    {
+#ifdef MLA_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = batchAVX2;
+            absMax = absMaxAVX2;
+            name = "avx2";
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            kernel = batchSSE2;
+            absMax = absMaxSSE2;
+            name = "sse2";
+        }
+#endif
+    }
+
+    BatchKernel kernel;
+    AbsMaxKernel absMax;
+    const char *name;
+};
+
+const KernelChoice &kernelChoice()
+{
+    static const KernelChoice choice;
+    return choice;
+}
+
+}
+
+void MLaEvaluateBatch(const MLaCoefficients &coefficients, size_t count,
+                      const double *amplitudes, const double *deltas,
+                      const double *depths, double *values)
+{
+    kernelChoice().kernel(coefficients, count, amplitudes, deltas, depths, values);
+}
+
+size_t MLaAbsMaxIndex(const double *data, size_t begin, size_t end,
+                      double offset)
+{
+    return kernelChoice().absMax(data, begin, end, offset);
+}
+
+const char *MLaBatchKernel()
+{
+    return kernelChoice().name;
+}
@@ -0,0 +1,63 @@
+/*
+ * File:   vectormath.h
+ */
+
+#ifndef __MLA_VECTORMATH_H__
+#define __MLA_VECTORMATH_H__
+
+#include "coefficients.h"
+
+#include <stddef.h>
+
+/*
+Accuracy of MLaEvaluateBatch() compared to the scalar Magnitude_MLA::formula()
+for amplitudes and distances in the range MLa is used for (amplitudes 1E-6 to
+1E6 mm, distances up to 11 degrees, depths up to 700 km). The distance term
+is bit identical, each log10 is within 2 ULP of the C library log10, which
+keeps the magnitudes within MLaBatchMaxError of the scalar ones; for
+magnitudes of at least 0.5 in size that is at most MLaBatchMaxUlp ULP.
+*/
+const double MLaBatchMaxError = 4E-15;
+const int MLaBatchMaxUlp = 16;
+
+/*
+Evaluates the MLa formula of one zone for a batch of station amplitudes of
+one origin. The inputs are separate arrays (structure of arrays) which are
+processed several values at a time using the widest vector instructions the
+CPU supports (AVX2 or SSE2, chosen at runtime), with a scalar fallback for
+other CPUs and for values the vector kernels do not handle (non positive,
+subnormal or non finite amplitudes and distances).
+
+@param coefficients: The coefficients of the zone the origin is in.
+@param count: The number of station amplitudes.
+@param amplitudes: The amplitudes (in millimetres).
+@param deltas: The epicentral distances (in degrees).
+@param depths: The depths of the hypocentre (in kms).
+@param values: Receives the magnitudes, may be one of the input arrays.
+*/
+void MLaEvaluateBatch(const MLaCoefficients &coefficients, size_t count,
+                      const double *amplitudes, const double *deltas,
+                      const double *depths, double *values);
+
+/*
+Finds the sample deviating most from an offset, exactly like the absolute
+maximum search of MLv: the first index of the largest |data[i] - offset| in
+[begin, end), where NaN samples other than data[begin] are never the
+maximum. Uses the same vector instructions as MLaEvaluateBatch().
+
+@param data: The samples.
+@param begin: The first sample searched.
+@param end: One past the last sample searched.
+@param offset: The offset removed from the samples.
+@returns The index of the maximum, begin if the range is empty.
+*/
+size_t MLaAbsMaxIndex(const double *data, size_t begin, size_t end,
+                      double offset);
+
+/*
+Returns the name of the vector kernels MLaEvaluateBatch() and
+MLaAbsMaxIndex() use on this machine: "avx2", "sse2" or "scalar".
+*/
+const char *MLaBatchKernel();
+
+#endif /* __MLA_VECTORMATH_H__ */